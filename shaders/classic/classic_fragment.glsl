@@ -1,43 +1,69 @@
 #version 330 core
 
+// Specialized with HAS_TEXTURE, ALPHA_TEST, SHADOW_TIER and CLUSTERED_LIGHTS, see ShaderPermutations
+
+in vec3 normal_world;
+#ifdef HAS_TEXTURE
 in vec2 texture_coords;
+#endif
+#if SHADOW_TIER > 0
 in vec4 depth_coords;
-in vec3 normal_transformed;
-in vec3 light_transformed;
+#endif
+#ifdef CLUSTERED_LIGHTS
+in vec3 world_position;
+in float view_depth;
+in vec4 clip_position;
+#endif
 
 out vec4 color;
 
-uniform vec4 diffuse_color;
+layout(std140) uniform ObjectBlock {
+    mat4 transform;
+    mat4 world;
+    mat4 depth_transform;
+    vec4 diffuse_color;
+    vec4 material;  // x - opacity
+};
+
+uniform vec3 light_direction;  // World space, towards the light
+
+#ifdef HAS_TEXTURE
 uniform sampler2D Texture;
-uniform int use_texture;
-uniform float opacity;
-uniform sampler2DShadow shadow_map;
+#endif
 
-vec2 poisson_coeffs[4] = vec2[](
-    vec2(-0.94201624,   -0.39906216),
-    vec2(0.94558609,    -0.76890725),
-    vec2(-0.094184101,  -0.92938870),
-    vec2(0.34495938,     0.29387760)
-);
+#include "../common/lighting.glsl"
 
 void main() {
-    float bias = 0.005f;
-    float visibility = 1.0f;
+#ifdef HAS_TEXTURE
+    color = texture(Texture, texture_coords);
+#else
+    color = diffuse_color;
+#endif
 
-    for (int i = 0; i < 4; i++) {
-        visibility -= 0.2f * (1.f - texture(shadow_map, vec3(depth_coords.xy + poisson_coeffs[i] / 1000.f, (depth_coords.z - bias) / depth_coords.w)));
+#ifdef ALPHA_TEST
+    if (color.a < 0.5f) {
+        discard;
     }
+#endif
 
-    vec3 n = normalize(normal_transformed);
-    vec3 l = normalize(light_transformed);
+    vec3 n = normalize(normal_world);
+    vec3 l = normalize(light_direction);
     float cos_theta = clamp(dot(n, l), 0.f, 1.f);
 
-    if (use_texture != 0) {
-        color = texture(Texture, texture_coords);
-    } else {
-        color = diffuse_color;
-    }
+#if SHADOW_TIER > 0
+    float visibility = shadow_visibility(depth_coords);
+#else
+    float visibility = 1.0f;
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+    vec3 albedo = color.rgb;
+#endif
+
     color *= visibility * cos_theta;
     color += 0.1f;
-    color.a = opacity;
-}
\ No newline at end of file
+#ifdef CLUSTERED_LIGHTS
+    color.rgb += albedo * point_lights(n, world_position, view_depth, clip_position.xy / clip_position.w);
+#endif
+    color.a = material.x;
+}
@@ -1,24 +1,52 @@
 #version 330
 
+// Specialized with HAS_TEXTURE, SHADOW_TIER and CLUSTERED_LIGHTS, see ShaderPermutations
+
 layout(location = 0) in vec3 vertex;
 layout(location = 1) in vec2 texture_coordinates;
 layout(location = 2) in vec3 normal;
 
-uniform mat4 transform;
-uniform mat4 depth_transform;
-uniform vec3 light_direction;
+layout(std140) uniform ObjectBlock {
+    mat4 transform;
+    mat4 world;
+    mat4 depth_transform;
+    vec4 diffuse_color;
+    vec4 material;  // x - opacity
+};
+
+// The object pass tests against the depth of the prepass with GL_EQUAL, the positions have to match exactly
+invariant gl_Position;
 
+out vec3 normal_world;
+#ifdef HAS_TEXTURE
 out vec2 texture_coords;
+#endif
+#if SHADOW_TIER > 0
 out vec4 depth_coords;
-out vec3 normal_transformed;
-out vec3 light_transformed;
+#endif
+#ifdef CLUSTERED_LIGHTS
+uniform mat4 view;
+
+out vec3 world_position;
+out float view_depth;
+out vec4 clip_position;
+#endif
 
 void main() {
     gl_Position = transform * vec4(vertex, 1.0f);
-    texture_coords = texture_coordinates;
 
-    depth_coords = depth_transform * vec4(vertex, 1.0f);
+    // Models are scaled uniformly, so the world matrix transforms normals as well
+    normal_world = mat3(world) * normal;
 
-    normal_transformed = (transform * vec4(normal, 0.f)).xyz;
-    light_transformed = (transform * vec4(light_direction, 0.f)).xyz;
+#ifdef HAS_TEXTURE
+    texture_coords = texture_coordinates;
+#endif
+#if SHADOW_TIER > 0
+    depth_coords = depth_transform * vec4(vertex, 1.0f);
+#endif
+#ifdef CLUSTERED_LIGHTS
+    world_position = (world * vec4(vertex, 1.0f)).xyz;
+    view_depth = -(view * vec4(world_position, 1.0f)).z;
+    clip_position = gl_Position;
+#endif
 }
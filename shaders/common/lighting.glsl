@@ -0,0 +1,62 @@
+// Lighting shared by the forward and the deferred object shaders.
+// Follows SHADOW_TIER and CLUSTERED_LIGHTS of the including shader
+
+#if SHADOW_TIER > 0
+uniform sampler2DShadow shadow_map;
+
+#if SHADOW_TIER == 2
+const vec2 poisson_coeffs[4] = vec2[](
+    vec2(-0.94201624,   -0.39906216),
+    vec2(0.94558609,    -0.76890725),
+    vec2(-0.094184101,  -0.92938870),
+    vec2(0.34495938,     0.29387760)
+);
+#endif
+
+float shadow_visibility(vec4 depth_coords) {
+    const float bias = 0.005f;
+    float depth = (depth_coords.z - bias) / depth_coords.w;
+
+#if SHADOW_TIER == 2
+    float visibility = 1.0f;
+    for (int i = 0; i < 4; i++) {
+        visibility -= 0.2f * (1.f - texture(shadow_map, vec3(depth_coords.xy + poisson_coeffs[i] / 1000.f, depth)));
+    }
+    return visibility;
+#else
+    // As dark as all four taps of the high tier together
+    return 1.0f - 0.8f * (1.f - texture(shadow_map, vec3(depth_coords.xy, depth)));
+#endif
+}
+#endif
+
+#ifdef CLUSTERED_LIGHTS
+uniform samplerBuffer light_data;       // Position and radius, color and intensity
+uniform usamplerBuffer light_clusters;  // Offset and count in light_indices
+uniform usamplerBuffer light_indices;
+uniform vec3 cluster_grid;
+uniform vec2 cluster_depth;             // x - near plane, y - slices per log unit of depth
+
+vec3 point_lights(vec3 n, vec3 world_position, float view_depth, vec2 ndc) {
+    ivec3 grid = ivec3(cluster_grid);
+    ivec2 tile = clamp(ivec2((0.5f * ndc + 0.5f) * cluster_grid.xy), ivec2(0), grid.xy - 1);
+    int slice = clamp(int(log(max(view_depth, cluster_depth.x) / cluster_depth.x) * cluster_depth.y), 0, grid.z - 1);
+
+    uvec2 range = texelFetch(light_clusters, tile.x + grid.x * (tile.y + grid.y * slice)).xy;
+
+    vec3 result = vec3(0.0f);
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(light_indices, int(range.x + i)).x);
+        vec4 position_radius = texelFetch(light_data, 2 * light);
+        vec4 color_intensity = texelFetch(light_data, 2 * light + 1);
+
+        vec3 to_light = position_radius.xyz - world_position;
+        float distance2 = max(dot(to_light, to_light), 1e-4f);
+        float falloff = clamp(1.0f - distance2 / (position_radius.w * position_radius.w), 0.0f, 1.0f);
+
+        float cos_theta = max(dot(n, to_light * inversesqrt(distance2)), 0.0f);
+        result += color_intensity.rgb * (color_intensity.a * falloff * falloff * cos_theta);
+    }
+    return result;
+}
+#endif
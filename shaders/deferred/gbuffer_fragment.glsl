@@ -0,0 +1,39 @@
+#version 330 core
+
+// Specialized with HAS_TEXTURE and ALPHA_TEST, see ShaderPermutations
+
+in vec3 normal_world;
+#ifdef HAS_TEXTURE
+in vec2 texture_coords;
+#endif
+
+layout(location = 0) out vec4 albedo;
+layout(location = 1) out vec4 normal;
+
+layout(std140) uniform ObjectBlock {
+    mat4 transform;
+    mat4 world;
+    mat4 depth_transform;
+    vec4 diffuse_color;
+    vec4 material;
+};
+
+#ifdef HAS_TEXTURE
+uniform sampler2D Texture;
+#endif
+
+void main() {
+#ifdef HAS_TEXTURE
+    albedo = texture(Texture, texture_coords);
+#else
+    albedo = diffuse_color;
+#endif
+
+#ifdef ALPHA_TEST
+    if (albedo.a < 0.5f) {
+        discard;
+    }
+#endif
+
+    normal = vec4(normalize(normal_world), 0.0f);
+}
@@ -0,0 +1,29 @@
+#version 330
+
+// Specialized with HAS_TEXTURE, see ShaderPermutations
+
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in vec2 texture_coordinates;
+layout(location = 2) in vec3 normal;
+
+layout(std140) uniform ObjectBlock {
+    mat4 transform;
+    mat4 world;
+    mat4 depth_transform;
+    vec4 diffuse_color;
+    vec4 material;
+};
+
+out vec3 normal_world;
+#ifdef HAS_TEXTURE
+out vec2 texture_coords;
+#endif
+
+void main() {
+    gl_Position = transform * vec4(vertex, 1.0f);
+    normal_world = mat3(world) * normal;
+
+#ifdef HAS_TEXTURE
+    texture_coords = texture_coordinates;
+#endif
+}
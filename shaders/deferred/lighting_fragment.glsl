@@ -0,0 +1,44 @@
+#version 330 core
+
+// Specialized with SHADOW_TIER and CLUSTERED_LIGHTS, see ShaderPermutations
+
+out vec4 color;
+
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_depth;
+
+uniform mat4 inverse_view_projection;
+uniform mat4 view;
+uniform mat4 depth_matrix;
+uniform vec3 light_direction;  // World space, towards the light
+
+#include "../common/lighting.glsl"
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbuffer_depth, texel, 0).r;
+    if (depth == 1.0f) {
+        discard;  // Background stays from the skybox
+    }
+
+    vec3 ndc = vec3(2.0f * gl_FragCoord.xy / vec2(textureSize(gbuffer_depth, 0)) - 1.0f, 2.0f * depth - 1.0f);
+    vec4 world = inverse_view_projection * vec4(ndc, 1.0f);
+    vec3 world_position = world.xyz / world.w;
+
+    vec3 albedo = texelFetch(gbuffer_albedo, texel, 0).rgb;
+    vec3 n = normalize(texelFetch(gbuffer_normal, texel, 0).xyz);
+    float cos_theta = clamp(dot(n, normalize(light_direction)), 0.f, 1.f);
+
+#if SHADOW_TIER > 0
+    float visibility = shadow_visibility(depth_matrix * vec4(world_position, 1.0f));
+#else
+    float visibility = 1.0f;
+#endif
+
+    color = vec4(albedo * visibility * cos_theta + 0.1f, 1.0f);
+#ifdef CLUSTERED_LIGHTS
+    float view_depth = -(view * vec4(world_position, 1.0f)).z;
+    color.rgb += albedo * point_lights(n, world_position, view_depth, ndc.xy);
+#endif
+}
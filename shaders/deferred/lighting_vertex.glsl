@@ -0,0 +1,7 @@
+#version 330
+
+// Full screen triangle without vertex data
+void main() {
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(2.0f * position - 1.0f, 0.0f, 1.0f);
+}
@@ -2,7 +2,16 @@
 
 layout(location = 0) in vec3 vertex;
 
-uniform mat4 transform;
+layout(std140) uniform ObjectBlock {
+    mat4 transform;
+    mat4 world;
+    mat4 depth_transform;
+    vec4 diffuse_color;
+    vec4 material;
+};
+
+// The object pass tests against the depth of the prepass with GL_EQUAL, the positions have to match exactly
+invariant gl_Position;
 
 void main() {
     gl_Position  = transform * vec4(vertex, 1.0f);
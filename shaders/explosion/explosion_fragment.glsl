@@ -0,0 +1,16 @@
+#version 330
+
+in vec4 color;
+
+out vec4 frag_color;
+
+void main() {
+    // Round soft sprite
+    float r = length(gl_PointCoord - vec2(0.5f));
+    if (r > 0.5f) {
+        discard;
+    }
+
+    frag_color = color;
+    frag_color.a *= 1.f - 2.f * r;
+}
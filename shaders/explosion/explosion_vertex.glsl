@@ -0,0 +1,18 @@
+#version 330
+
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in float life;
+layout(location = 2) in vec4 particle_color;
+
+uniform mat4 transform;
+uniform float point_size;
+
+out vec4 color;
+
+void main() {
+    gl_Position = transform * vec4(vertex, 1.0f);
+    gl_PointSize = max(point_size * life / gl_Position.w, 1.0f);
+
+    color = particle_color;
+    color.a *= life;
+}
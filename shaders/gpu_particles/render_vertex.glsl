@@ -0,0 +1,20 @@
+#version 330
+
+layout(location = 0) in vec3 position;
+layout(location = 2) in vec2 age;
+layout(location = 3) in vec4 particle_color;
+
+uniform mat4 transform;
+uniform float point_size;
+
+out vec4 color;
+
+void main() {
+    float life = age.x < 0.f ? 0.f : clamp(1.f - age.x / max(age.y, 1e-4f), 0.f, 1.f);
+
+    gl_Position = transform * vec4(position, 1.0f);
+    gl_PointSize = max(point_size * life / gl_Position.w, 1.0f);
+
+    color = particle_color;
+    color.a *= life;
+}
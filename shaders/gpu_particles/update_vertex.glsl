@@ -0,0 +1,61 @@
+#version 330
+
+layout(location = 0) in vec3 position;
+layout(location = 1) in vec3 velocity;
+layout(location = 2) in vec2 age;
+layout(location = 3) in vec4 color;
+
+out vec3 out_position;
+out vec3 out_velocity;
+out vec2 out_age;
+out vec4 out_color;
+
+uniform float dt;
+uniform uint seed;
+uniform float damping;
+
+uniform vec3 emitter_position;
+uniform vec3 emitter_direction;
+uniform float emitter_spread;
+uniform float emitter_speed;
+uniform float emitter_lifetime;
+uniform vec4 emitter_color;
+
+// Integer hash by Chris Wellons
+uint hash(uint x) {
+    x ^= x >> 16u;
+    x *= 0x7feb352du;
+    x ^= x >> 15u;
+    x *= 0x846ca68bu;
+    x ^= x >> 16u;
+    return x;
+}
+
+float random(inout uint state) {
+    state = hash(state);
+    return float(state >> 8u) / 16777216.0f;
+}
+
+void main() {
+    float new_age = age.x + dt;
+
+    if (age.x < 0.f || new_age < age.y) {
+        // Alive or not born yet
+        out_position = position + (age.x < 0.f ? vec3(0.f) : velocity * dt);
+        out_velocity = velocity * damping;
+        out_age = vec2(new_age, age.y);
+        out_color = color;
+        return;
+    }
+
+    // Respawn at the emitter
+    uint state = hash(uint(gl_VertexID) ^ hash(seed));
+
+    vec3 random_direction = normalize(vec3(random(state), random(state), random(state)) * 2.f - 1.f + 1e-4f);
+    vec3 direction = normalize(mix(emitter_direction, random_direction, emitter_spread));
+
+    out_position = emitter_position;
+    out_velocity = direction * emitter_speed * (0.5f + 0.5f * random(state));
+    out_age = vec2(0.f, emitter_lifetime * (0.5f + 0.5f * random(state)));
+    out_color = emitter_color;
+}
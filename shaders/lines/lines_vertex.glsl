@@ -0,0 +1,13 @@
+#version 330
+
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in vec4 vertex_color;
+
+uniform mat4 transform;
+
+out vec4 color;
+
+void main() {
+    gl_Position = transform * vec4(vertex, 1.0f);
+    color = vertex_color;
+}
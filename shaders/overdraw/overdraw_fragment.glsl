@@ -0,0 +1,8 @@
+#version 330 core
+
+out vec4 color;
+
+// Accumulated with additive blending, the red channel saturates after 8 shaded layers
+void main() {
+    color = vec4(0.125f, 0.0625f, 0.03125f, 1.0f);
+}
@@ -0,0 +1,264 @@
+#include "Allocations.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <ostream>
+
+// Plain data, so the counters are usable before any static constructor runs
+static thread_local size_t allocations = 0;
+static thread_local size_t allocated_bytes = 0;
+
+static std::atomic<size_t> violations(0);
+
+AllocationCount thread_allocation_count() {
+    return {allocations, allocated_bytes};
+}
+
+ZeroAllocationScope::~ZeroAllocationScope() {
+    const auto made = thread_allocation_count() - start;
+    if (made.allocations > 0) {
+        violations++;
+        std::fprintf(stderr, "Zero allocation scope \"%s\" allocated %zu times, %zu bytes\n",
+                     name, made.allocations, made.bytes);
+    }
+}
+
+size_t zero_allocation_violations() {
+    return violations.load();
+}
+
+// malloc with the retries through the new handler the standard asks for
+static void* allocate(std::size_t size) {
+    while (true) {
+        void* pointer = std::malloc(size > 0 ? size : 1);
+        if (pointer != nullptr) {
+            return pointer;
+        }
+
+        const auto handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+#ifdef TRACK_ALLOCATIONS
+
+// Everything here is constant initialized and the tracking never allocates itself,
+// so it works for the allocations of static constructors and inside operator new
+static const int max_scopes = 64;
+
+struct ScopeCounters {
+    std::atomic<const char*> name;
+    std::atomic<size_t> allocations;  // In the current frame
+    std::atomic<size_t> bytes;
+    std::atomic<size_t> live_allocations;
+    std::atomic<size_t> live_bytes;
+};
+
+static ScopeCounters scopes[max_scopes];   // 0 counts the allocations outside of any scope
+static std::atomic<int> scope_count(1);
+static std::mutex registration_mutex;
+
+static thread_local int current_scope = 0;
+static thread_local bool untracked = false;  // Set while exporting, the allocations of the file IO stay out of the list
+
+// Prepended to every allocation, a multiple of the alignment malloc guarantees
+struct alignas(16) Header {
+    Header* previous;
+    Header* next;
+    size_t size;
+    size_t sequence;
+    int scope;
+    bool linked;
+};
+
+static_assert(sizeof(Header) % 16 == 0, "The header has to keep the alignment of malloc");
+
+static Header* live = nullptr;
+static std::mutex live_mutex;
+static std::atomic<size_t> next_sequence(0);
+
+static int register_scope(const char* name) {
+    // Scopes of the same name in different translation units may have distinct literals
+    const int count = scope_count.load(std::memory_order_acquire);
+    for (int i = 1; i < count; i++) {
+        if (std::strcmp(scopes[i].name.load(std::memory_order_relaxed), name) == 0) {
+            return i;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(registration_mutex);
+    const int registered = scope_count.load(std::memory_order_relaxed);
+    for (int i = count; i < registered; i++) {
+        if (std::strcmp(scopes[i].name.load(std::memory_order_relaxed), name) == 0) {
+            return i;
+        }
+    }
+
+    // The table is full, the allocations go to the scope around
+    if (registered == max_scopes) {
+        return current_scope;
+    }
+    scopes[registered].name.store(name, std::memory_order_relaxed);
+    scope_count.store(registered + 1, std::memory_order_release);
+    return registered;
+}
+
+AllocationScope::AllocationScope(const char* name) : previous(current_scope) {
+    current_scope = register_scope(name);
+}
+
+AllocationScope::~AllocationScope() {
+    current_scope = previous;
+}
+
+static const char* scope_name(int scope) {
+    return scope == 0 ? "unscoped" : scopes[scope].name.load(std::memory_order_relaxed);
+}
+
+void next_allocation_frame() {
+    const int count = scope_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        scopes[i].allocations.store(0, std::memory_order_relaxed);
+        scopes[i].bytes.store(0, std::memory_order_relaxed);
+    }
+}
+
+void report_allocations(std::ostream& stream) {
+    stream << "Allocations in the frame, live allocations:\n";
+    const int count = scope_count.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        const auto& counters = scopes[i];
+        stream << "  " << scope_name(i) << ": " << counters.allocations.load() << " (" << counters.bytes.load()
+               << " bytes), " << counters.live_allocations.load() << " live (" << counters.live_bytes.load() << " bytes)\n";
+    }
+    stream << "  Zero allocation violations: " << zero_allocation_violations() << std::endl;
+}
+
+bool export_live_allocations(const char* path) {
+    untracked = true;
+    std::FILE* file = std::fopen(path, "w");
+    if (file != nullptr) {
+        std::fprintf(file, "sequence,scope,bytes\n");
+
+        std::lock_guard<std::mutex> lock(live_mutex);
+        for (auto header = live; header != nullptr; header = header->next) {
+            std::fprintf(file, "%zu,%s,%zu\n", header->sequence, scope_name(header->scope), header->size);
+        }
+    }
+    const bool written = file != nullptr && std::fclose(file) == 0;
+    untracked = false;
+    return written;
+}
+
+void* operator new(std::size_t size) {
+    allocations++;
+    allocated_bytes += size;
+
+    auto header = static_cast<Header*>(allocate(size + sizeof(Header)));
+    header->size = size;
+    header->sequence = next_sequence.fetch_add(1, std::memory_order_relaxed);
+    header->scope = current_scope;
+    header->linked = !untracked;
+
+    auto& counters = scopes[header->scope];
+    counters.allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.bytes.fetch_add(size, std::memory_order_relaxed);
+    counters.live_allocations.fetch_add(1, std::memory_order_relaxed);
+    counters.live_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    if (header->linked) {
+        std::lock_guard<std::mutex> lock(live_mutex);
+        header->previous = nullptr;
+        header->next = live;
+        if (live != nullptr) {
+            live->previous = header;
+        }
+        live = header;
+    }
+    return header + 1;
+}
+
+void operator delete(void* pointer) noexcept {
+    if (pointer == nullptr) {
+        return;
+    }
+
+    auto header = static_cast<Header*>(pointer) - 1;
+    auto& counters = scopes[header->scope];
+    counters.live_allocations.fetch_sub(1, std::memory_order_relaxed);
+    counters.live_bytes.fetch_sub(header->size, std::memory_order_relaxed);
+
+    if (header->linked) {
+        std::lock_guard<std::mutex> lock(live_mutex);
+        if (header->previous != nullptr) {
+            header->previous->next = header->next;
+        } else {
+            live = header->next;
+        }
+        if (header->next != nullptr) {
+            header->next->previous = header->previous;
+        }
+    }
+    std::free(header);
+}
+
+#else
+
+void next_allocation_frame() {}
+
+void report_allocations(std::ostream& stream) {
+    stream << "Zero allocation violations: " << zero_allocation_violations()
+           << " (build with TRACK_ALLOCATIONS for the allocations per scope)" << std::endl;
+}
+
+bool export_live_allocations(const char*) {
+    return false;
+}
+
+void* operator new(std::size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    return allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    std::free(pointer);
+}
+
+#endif
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return operator new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete[](void* pointer) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t&) noexcept {
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept {
+    operator delete(pointer);
+}
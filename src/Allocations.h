@@ -0,0 +1,76 @@
+#ifndef SPACEOBJECTS_ALLOCATIONS_H
+#define SPACEOBJECTS_ALLOCATIONS_H
+
+#include <cstddef>
+#include <iosfwd>
+
+// Heap allocations through operator new, counted per thread.
+// The global operators are replaced in Allocations.cpp, the counting costs two increments.
+// Building with TRACK_ALLOCATIONS also tags every allocation with the innermost scope of its thread
+// and keeps the live ones in a list, for the per subsystem report and leak hunting
+struct AllocationCount {
+    size_t allocations = 0;
+    size_t bytes = 0;
+
+    AllocationCount() = default;
+
+    AllocationCount(size_t allocations, size_t bytes) : allocations(allocations), bytes(bytes) {}
+
+    AllocationCount operator-(const AllocationCount& other) const {
+        return {allocations - other.allocations, bytes - other.bytes};
+    }
+};
+
+// Allocations made by the calling thread since it started
+AllocationCount thread_allocation_count();
+
+// Allocations of the thread inside the scope are reported under its name.
+// The name has to be a string literal, scopes with the same name share the counters
+class AllocationScope {
+#ifdef TRACK_ALLOCATIONS
+    int previous;
+
+public:
+    explicit AllocationScope(const char* name);
+
+    ~AllocationScope();
+#else
+public:
+    explicit AllocationScope(const char*) {}
+#endif
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+};
+
+// Code expected not to allocate. An allocation of the thread inside the scope is printed
+// with the name when it ends and counted as a violation, which fails the benchmarks
+class ZeroAllocationScope {
+    const char* name;
+    AllocationCount start;
+
+public:
+    explicit ZeroAllocationScope(const char* name) : name(name), start(thread_allocation_count()) {}
+
+    ~ZeroAllocationScope();
+
+    ZeroAllocationScope(const ZeroAllocationScope&) = delete;
+    ZeroAllocationScope& operator=(const ZeroAllocationScope&) = delete;
+};
+
+// Zero allocation scopes which allocated, since the start
+size_t zero_allocation_violations();
+
+// Restart the per frame counters of the scopes
+void next_allocation_frame();
+
+// Allocations per scope since the start of the frame and the live ones.
+// Only the violations without TRACK_ALLOCATIONS
+void report_allocations(std::ostream& stream);
+
+// Every live allocation as CSV lines of sequence number, scope and size. The sequence number tells
+// the order of the allocations, so the ones made after a point of interest stand out.
+// Returns false without TRACK_ALLOCATIONS or if the file can't be written
+bool export_live_allocations(const char* path);
+
+#endif //SPACEOBJECTS_ALLOCATIONS_H
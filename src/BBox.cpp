@@ -1 +1,46 @@
 #include "BBox.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define BBOX_USE_SSE
+#endif
+
+void transform_bboxes(const BBox* local, const glm::mat4* transforms, BBox* world, size_t count) {
+#ifdef BBOX_USE_SSE
+    const __m128 sign_mask = _mm_set1_ps(-0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    float min[4];
+    float max[4];
+
+    for (size_t i = 0; i < count; i++) {
+        const auto& transform = transforms[i];
+        const __m128 column0 = _mm_loadu_ps(&transform[0][0]);
+        const __m128 column1 = _mm_loadu_ps(&transform[1][0]);
+        const __m128 column2 = _mm_loadu_ps(&transform[2][0]);
+        const __m128 column3 = _mm_loadu_ps(&transform[3][0]);
+
+        const auto& box = local[i];
+        const __m128 box_min = _mm_setr_ps(box.min.x, box.min.y, box.min.z, 0.0f);
+        const __m128 box_max = _mm_setr_ps(box.max.x, box.max.y, box.max.z, 0.0f);
+        const __m128 center = _mm_mul_ps(_mm_add_ps(box_min, box_max), half);
+        const __m128 extent = _mm_mul_ps(_mm_sub_ps(box_max, box_min), half);
+
+        // Broadcast each coordinate and accumulate the columns
+        __m128 world_center = _mm_add_ps(column3, _mm_mul_ps(column0, _mm_shuffle_ps(center, center, 0x00)));
+        world_center = _mm_add_ps(world_center, _mm_mul_ps(column1, _mm_shuffle_ps(center, center, 0x55)));
+        world_center = _mm_add_ps(world_center, _mm_mul_ps(column2, _mm_shuffle_ps(center, center, 0xAA)));
+
+        __m128 world_extent = _mm_mul_ps(_mm_andnot_ps(sign_mask, column0), _mm_shuffle_ps(extent, extent, 0x00));
+        world_extent = _mm_add_ps(world_extent, _mm_mul_ps(_mm_andnot_ps(sign_mask, column1), _mm_shuffle_ps(extent, extent, 0x55)));
+        world_extent = _mm_add_ps(world_extent, _mm_mul_ps(_mm_andnot_ps(sign_mask, column2), _mm_shuffle_ps(extent, extent, 0xAA)));
+
+        _mm_storeu_ps(min, _mm_sub_ps(world_center, world_extent));
+        _mm_storeu_ps(max, _mm_add_ps(world_center, world_extent));
+        world[i] = BBox(glm::vec3(min[0], min[1], min[2]), glm::vec3(max[0], max[1], max[2]));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        world[i] = local[i].transformed(transforms[i]);
+    }
+#endif
+}
@@ -1,6 +1,7 @@
 #ifndef SPACEOBJECTS_BBOX_H
 #define SPACEOBJECTS_BBOX_H
 
+#include <cstddef>
 #include <glm/glm.hpp>
 #include <glm/gtx/extended_min_max.hpp>
 
@@ -12,6 +13,15 @@ struct BBox {
 
     BBox(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
 
+    // Smallest axis aligned box containing this one after an affine transform (Arvo's method):
+    // the center is transformed, the half extent goes through the absolute values of the linear part
+    BBox transformed(const glm::mat4& transform) const {
+        const auto center = glm::vec3(transform * glm::vec4(0.5f * (min + max), 1.0f));
+        const auto extent = glm::mat3(glm::abs(transform[0]), glm::abs(transform[1]), glm::abs(transform[2]))
+                          * (0.5f * (max - min));
+        return BBox(center - extent, center + extent);
+    }
+
     friend bool intersect(const BBox& first, const BBox& second) {
         return first.min.x <= second.max.x && first.max.x >= second.min.x
             && first.min.y <= second.max.y && first.max.y >= second.min.y
@@ -28,8 +38,12 @@ struct BBox {
         float tmin = glm::max(dist_min.x, glm::max(dist_min.y, dist_min.z));
         float tmax = glm::min(dist_max.x, glm::min(dist_max.y, dist_max.z));
 
-        return tmax >= tmin;
+        // Boxes entirely behind the source are not hit
+        return tmax >= glm::max(tmin, 0.0f);
     }
 };
 
+// Same as BBox::transformed for many boxes at once, vectorized where SSE is available
+void transform_bboxes(const BBox* local, const glm::mat4* transforms, BBox* world, size_t count);
+
 #endif //SPACEOBJECTS_BBOX_H
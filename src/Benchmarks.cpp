@@ -0,0 +1,416 @@
+#include "Benchmarks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <glm/gtx/quaternion.hpp>
+
+#include "Allocations.h"
+#include "Broadphase.h"
+#include "Entities.h"
+#include "Model.h"
+#include "RayQuery.h"
+#include "WorkerPool.h"
+
+// Average milliseconds per call over `iterations` calls after one warm up call
+static double measure(int iterations, const std::function<void()>& step) {
+    step();
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        step();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli>(end - start).count() / iterations;
+}
+
+// Asteroid as the game used to keep them in a list: a copy of its model with its own transform,
+// moving along its velocity and caching its world bounds until the next move
+struct ListAsteroid {
+    Model model;
+    glm::vec3 velocity;
+    glm::vec3 position;
+    glm::mat4 rotation;
+    bool dead = false;
+
+    mutable BBox world_bbox;
+    mutable bool bbox_dirty = true;
+
+    ListAsteroid(const Model& model, const glm::vec3& position, const glm::vec3& velocity) :
+        model(model),
+        velocity(velocity),
+        position(position),
+        rotation(glm::toMat4(glm::rotation(glm::vec3(0.0f, 0.0f, 1.0f), glm::normalize(velocity)))) {}
+
+    void move_auto(float alpha) {
+        position += alpha * velocity;
+        bbox_dirty = true;
+    }
+
+    const BBox& get_bbox() const {
+        if (bbox_dirty) {
+            world_bbox = model.bbox.transformed(glm::translate(glm::mat4(1.0f), position) * rotation);
+            bbox_dirty = false;
+        }
+        return world_bbox;
+    }
+};
+
+// One simulation step over `count` moving asteroids: move, refresh the world bounds and
+// scan them like the laser does, plus 1% of them dying and respawning.
+// The list of models the game used to keep is measured against the entity store
+static int benchmark_entities(size_t count) {
+    const int steps = 100;
+    const BBox unit_box(glm::vec3(-1.0f), glm::vec3(1.0f));
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> speed(-1.0f, 1.0f);
+    std::uniform_int_distribution<size_t> pick(0, count - 1);
+
+    Model prototype;
+    prototype.bbox = unit_box;
+
+    std::list<ListAsteroid> asteroids;
+    for (size_t i = 0; i < count; i++) {
+        asteroids.push_back(ListAsteroid(prototype, glm::vec3(coordinate(random), coordinate(random), coordinate(random)),
+                                         glm::vec3(speed(random), speed(random), 1.0f)));
+    }
+
+    size_t hits = 0;
+    const double list_time = measure(steps, [&]() {
+        for (auto& asteroid : asteroids) {
+            if (asteroid.dead) continue;
+            asteroid.move_auto(1.0f);
+        }
+        for (const auto& asteroid : asteroids) {
+            if (asteroid.dead) continue;
+            hits += asteroid.get_bbox().max.z > 0.0f;
+        }
+        for (size_t i = 0; i < count / 100; i++) {
+            asteroids.pop_front();
+            asteroids.push_back(ListAsteroid(prototype, glm::vec3(0.0f), glm::vec3(speed(random), speed(random), 1.0f)));
+        }
+    });
+
+    EntityStore entities;
+    entities.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        entities.create(&prototype, unit_box, glm::vec3(coordinate(random), coordinate(random), coordinate(random)),
+                        glm::mat4(1.0f), glm::vec3(speed(random), speed(random), 1.0f));
+    }
+
+    const double store_time = measure(steps, [&]() {
+        entities.integrate();
+        entities.update_transforms();
+        for (size_t i = 0; i < entities.size(); i++) {
+            hits += entities.bounds[i].max.z > 0.0f;
+        }
+        for (size_t i = 0; i < count / 100; i++) {
+            entities.remove(entities.handle(pick(random) % entities.size()));
+            entities.create(&prototype, unit_box, glm::vec3(coordinate(random), coordinate(random), coordinate(random)),
+                            glm::mat4(1.0f), glm::vec3(speed(random), speed(random), 1.0f));
+        }
+    });
+
+    std::cout << "Entities: " << count << " asteroids, " << steps << " steps\n"
+              << "  std::list<ListAsteroid>: " << list_time << " ms per step\n"
+              << "  EntityStore:             " << store_time << " ms per step\n"
+              << "  (" << hits << " boxes in front)" << std::endl;
+    return 0;
+}
+
+// Overlapping pairs of moving asteroids with every backend, at a hundredth,
+// a tenth and all of `count` asteroids. The field grows with the count to keep the density.
+// Fails when the backends disagree on the pairs of the last tick
+static int benchmark_broadphase(size_t count) {
+    const int steps = 30;
+
+    for (const size_t asteroids : {count / 100, count / 10, count}) {
+        if (asteroids == 0) continue;
+
+        std::mt19937 random(42);
+        const float field = 10.0f * std::cbrt(float(asteroids));
+        std::uniform_real_distribution<float> coordinate(0.0f, field);
+        std::uniform_real_distribution<float> size(0.5f, 2.0f);
+        std::uniform_real_distribution<float> speed(-0.2f, 0.2f);
+
+        std::vector<BBox> initial(asteroids);
+        std::vector<glm::vec3> velocities(asteroids);
+        for (size_t i = 0; i < asteroids; i++) {
+            const glm::vec3 position(coordinate(random), coordinate(random), coordinate(random));
+            initial[i] = BBox(position, position + size(random));
+            velocities[i] = glm::vec3(speed(random), speed(random), speed(random));
+        }
+
+        std::cout << "Broadphase: " << asteroids << " asteroids, " << steps << " ticks" << std::endl;
+
+        std::vector<BroadphasePair> pairs;
+        std::vector<std::pair<uint32_t, uint32_t>> reference;  // Of the first backend on the last tick
+        const char* reference_name = nullptr;
+        for (int type = 0; type < int(BroadphaseType::COUNT); type++) {
+            auto broadphase = Broadphase::create(BroadphaseType(type));
+            auto boxes = initial;
+
+            const double time = measure(steps, [&]() {
+                for (size_t i = 0; i < asteroids; i++) {
+                    boxes[i].min += velocities[i];
+                    boxes[i].max += velocities[i];
+                }
+                broadphase->update(boxes.data(), boxes.size());
+                broadphase->find_pairs(pairs);
+            });
+
+            std::cout << "  " << broadphase->name() << ": " << time << " ms per tick, "
+                      << pairs.size() << " pairs" << std::endl;
+
+            // Every backend ran the same ticks, they have to report the same pairs in any order
+            std::vector<std::pair<uint32_t, uint32_t>> found;
+            for (const auto& pair : pairs) {
+                found.emplace_back(std::min(pair.first, pair.second), std::max(pair.first, pair.second));
+            }
+            std::sort(found.begin(), found.end());
+
+            if (type == 0) {
+                reference.swap(found);
+                reference_name = broadphase->name();
+            } else if (found != reference) {
+                std::cerr << "Broadphase mismatch: " << broadphase->name() << " doesn't report the pairs of "
+                          << reference_name << std::endl;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Nearest hit of random rays from the middle of a field of `count` asteroids,
+// one box at a time with the scalar slab test against the packed query
+static int benchmark_rays(size_t count) {
+    const int rays = 200;
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 2.0f);
+    std::normal_distribution<float> axis(0.0f, 1.0f);
+
+    std::vector<BBox> boxes(count);
+    for (auto& box : boxes) {
+        const glm::vec3 position(coordinate(random), coordinate(random), coordinate(random));
+        box = BBox(position, position + size(random));
+    }
+
+    std::vector<glm::vec3> directions(rays);
+    for (auto& direction : directions) {
+        direction = glm::normalize(glm::vec3(axis(random), axis(random), axis(random)));
+    }
+
+    const glm::vec3 origin(0.0f);
+    const float max_distance = 1000.0f;
+    size_t scalar_hits = 0, packed_hits = 0;
+
+    const double scalar_time = measure(1, [&]() {
+        scalar_hits = 0;
+        for (const auto& direction : directions) {
+            const auto direction_inverse = 1.0f / direction;
+            for (const auto& box : boxes) {
+                scalar_hits += intersect(box, origin, direction_inverse);
+            }
+        }
+    });
+
+    PackedBounds packed;
+    packed.assign(boxes.data(), boxes.size());
+
+    const double packed_time = measure(10, [&]() {
+        packed_hits = 0;
+        for (const auto& direction : directions) {
+            packed_hits += intersect_nearest(packed, origin, direction, max_distance).index != count;
+        }
+    });
+
+    const double tests = double(rays) * double(count);
+    std::cout << "Rays: " << rays << " rays against " << count << " asteroids\n"
+              << "  scalar slab test: " << tests / scalar_time << " boxes per ms, " << scalar_hits << " hits\n"
+              << "  packed " << ray_query_isa() << ": " << tests / packed_time << " boxes per ms, "
+              << packed_hits << " rays with a nearest hit" << std::endl;
+    return 0;
+}
+
+// Asteroids spawning and despawning at 1% of `count` per step in a pool of `count` entities
+// with a transform hierarchy, as in the game. The heap allocations of the steps are counted,
+// after the first step the pool is expected to make none
+static int benchmark_spawning(size_t count) {
+    const int steps = 100;
+    const BBox unit_box(glm::vec3(-1.0f), glm::vec3(1.0f));
+
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+    std::uniform_int_distribution<size_t> pick(0, count - 1);
+
+    Model prototype;
+    TransformHierarchy transforms;
+    EntityStore entities(&transforms);
+    entities.reserve(count);
+    transforms.reserve(count);
+
+    for (size_t i = 0; i < count / 2; i++) {
+        entities.create(&prototype, unit_box, glm::vec3(coordinate(random), coordinate(random), coordinate(random)),
+                        glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    }
+
+    AllocationCount allocations;
+    auto churn = [&]() {
+        const auto before = thread_allocation_count();
+
+        for (size_t i = 0; i < count / 100 && entities.size() > 0; i++) {
+            entities.remove(entities.handle(pick(random) % entities.size()));
+        }
+        for (size_t i = 0; i < count / 100 && entities.size() < entities.capacity(); i++) {
+            entities.create(&prototype, unit_box, glm::vec3(coordinate(random), coordinate(random), coordinate(random)),
+                            glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        }
+        entities.integrate();
+        entities.update_transforms();
+
+        allocations = thread_allocation_count() - before;
+    };
+
+    // The warm up step of the measurement may still allocate, after it the pool is expected not to
+    bool warmed_up = false;
+    const double time = measure(steps, [&]() {
+        if (warmed_up) {
+            ZeroAllocationScope no_allocations("spawning");
+            churn();
+        } else {
+            churn();
+            warmed_up = true;
+        }
+    });
+
+    std::cout << "Spawning: " << count / 100 << " spawns and despawns per step in a pool of " << count << "\n"
+              << "  " << time << " ms per step, " << allocations.allocations << " heap allocations ("
+              << allocations.bytes << " bytes) in the last step" << std::endl;
+    return 0;
+}
+
+// One simulation step over `count` entities as a graph of jobs: bounds update, then collision and culling
+// against a view volume, with a particle update of `count` particles alongside. Runs on 1 to N workers,
+// N being the number of cores
+static int benchmark_jobs(size_t count) {
+    const int steps = 30;
+    const BBox unit_box(glm::vec3(-1.0f), glm::vec3(1.0f));
+    const BBox view_volume(glm::vec3(-200.0f, -100.0f, -500.0f), glm::vec3(200.0f, 100.0f, 0.0f));
+    const int max_workers = std::max(int(std::thread::hardware_concurrency()), 1);
+
+    Model prototype;
+    double single_time = 0.0;
+
+    std::cout << "Jobs: " << count << " entities and particles, " << steps << " steps" << std::endl;
+
+    for (int worker_count = 1; worker_count <= max_workers; worker_count++) {
+        WorkerPool pool(worker_count - 1);
+
+        // The same scene for every worker count
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> coordinate(-500.0f, 500.0f);
+        std::uniform_real_distribution<float> speed(-0.2f, 0.2f);
+
+        EntityStore entities;
+        entities.reserve(count);
+        for (size_t i = 0; i < count; i++) {
+            entities.create(&prototype, unit_box, glm::vec3(coordinate(random), coordinate(random), coordinate(random)),
+                            glm::mat4(1.0f), glm::vec3(speed(random), speed(random), speed(random)));
+        }
+
+        std::vector<glm::vec3> particles(count), particle_velocities(count);
+        for (size_t i = 0; i < count; i++) {
+            particles[i] = glm::vec3(coordinate(random), coordinate(random), coordinate(random));
+            particle_velocities[i] = glm::vec3(speed(random), speed(random), speed(random));
+        }
+
+        auto broadphase = Broadphase::create(BroadphaseType::SWEEP_AND_PRUNE);
+        std::vector<BroadphasePair> pairs;
+        std::vector<size_t> visible(pool.size());
+
+        const double time = measure(steps, [&]() {
+            WorkerPool::Counter moved, done;
+
+            pool.submit([&](int) {
+                entities.integrate();
+                entities.update_transforms(&pool);
+            }, &moved);
+
+            pool.submit([&](int) {
+                broadphase->update(entities.bounds.data(), entities.size());
+                broadphase->find_pairs(pairs);
+            }, &done, &moved);
+
+            pool.submit([&](int) {
+                std::fill(visible.begin(), visible.end(), 0);
+                pool.parallel_for(entities.size(), 1024, [&](size_t begin, size_t end, int worker) {
+                    for (size_t i = begin; i < end; i++) {
+                        visible[worker] += intersect(entities.bounds[i], view_volume);
+                    }
+                });
+            }, &done, &moved);
+
+            pool.submit([&](int) {
+                pool.parallel_for(count, 4096, [&](size_t begin, size_t end, int) {
+                    for (size_t i = begin; i < end; i++) {
+                        particle_velocities[i] *= 0.99f;
+                        particles[i] += particle_velocities[i];
+                    }
+                });
+            }, &done);
+
+            pool.wait(done);
+        });
+
+        if (worker_count == 1) {
+            single_time = time;
+        }
+
+        size_t in_view = 0;
+        for (const auto worker_visible : visible) {
+            in_view += worker_visible;
+        }
+
+        std::cout << "  " << worker_count << " workers: " << time << " ms per step, " << single_time / time
+                  << "x speedup, " << pairs.size() << " pairs, " << in_view << " in view" << std::endl;
+    }
+    return 0;
+}
+
+int run_benchmark(const std::string& name, size_t count) {
+    static const std::map<std::string, std::function<int(size_t)>> benchmarks = {
+        {"entities", benchmark_entities},
+        {"broadphase", benchmark_broadphase},
+        {"rays", benchmark_rays},
+        {"spawning", benchmark_spawning},
+        {"jobs", benchmark_jobs},
+    };
+
+    const auto it = benchmarks.find(name);
+    if (it == benchmarks.end() || count == 0) {
+        std::cerr << "Unknown benchmark: " << name << ". Available:";
+        for (const auto& pair : benchmarks) {
+            std::cerr << " " << pair.first;
+        }
+        std::cerr << std::endl;
+        return 1;
+    }
+
+    // Benchmarks mark the code expected not to allocate, an allocation there fails the run
+    const int result = it->second(count);
+    return result != 0 ? result : (zero_allocation_violations() > 0 ? 1 : 0);
+}
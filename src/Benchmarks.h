@@ -0,0 +1,12 @@
+#ifndef SPACEOBJECTS_BENCHMARKS_H
+#define SPACEOBJECTS_BENCHMARKS_H
+
+#include <cstddef>
+#include <string>
+
+// Micro benchmarks of the engine subsystems. They run without a window or a GL context:
+//   main --benchmark <name> [count]
+// Returns the exit code, non zero for an unknown name
+int run_benchmark(const std::string& name, size_t count);
+
+#endif //SPACEOBJECTS_BENCHMARKS_H
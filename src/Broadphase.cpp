@@ -0,0 +1,362 @@
+#include "Broadphase.h"
+
+#include <algorithm>
+
+std::unique_ptr<Broadphase> Broadphase::create(BroadphaseType type) {
+    switch (type) {
+        case BroadphaseType::SPATIAL_HASH:
+            return std::unique_ptr<Broadphase>(new SpatialHash());
+        case BroadphaseType::AABB_TREE:
+            return std::unique_ptr<Broadphase>(new AabbTree());
+        default:
+            return std::unique_ptr<Broadphase>(new SweepAndPrune());
+    }
+}
+
+static BroadphasePair make_pair(uint32_t first, uint32_t second) {
+    return first < second ? BroadphasePair{first, second} : BroadphasePair{second, first};
+}
+
+// Sweep and prune
+
+void SweepAndPrune::update(const BBox* boxes, size_t count) {
+    this->boxes = boxes;
+
+    const auto by_min = [boxes](uint32_t first, uint32_t second) {
+        return boxes[first].min.x < boxes[second].min.x;
+    };
+
+    size_t added = 0;
+    if (count != this->count) {
+        // Keep the order of the proxies still there, the new ones go to the end
+        order.erase(std::remove_if(order.begin(), order.end(), [count](uint32_t proxy) {
+            return proxy >= count;
+        }), order.end());
+        for (size_t proxy = this->count; proxy < count; proxy++) {
+            order.push_back(uint32_t(proxy));
+        }
+        added = count > this->count ? count - this->count : 0;
+        this->count = count;
+    }
+
+    if (added > 64) {
+        std::sort(order.begin(), order.end(), by_min);
+        return;
+    }
+
+    // Boxes move a little per tick, so only a few proxies travel a short way
+    for (size_t i = 1; i < order.size(); i++) {
+        const uint32_t proxy = order[i];
+        size_t j = i;
+        while (j > 0 && by_min(proxy, order[j - 1])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = proxy;
+    }
+}
+
+void SweepAndPrune::find_pairs(std::vector<BroadphasePair>& pairs) {
+    pairs.clear();
+
+    for (size_t a = 0; a < order.size(); a++) {
+        const auto& box = boxes[order[a]];
+
+        for (size_t b = a + 1; b < order.size() && boxes[order[b]].min.x <= box.max.x; b++) {
+            const auto& other = boxes[order[b]];
+            if (box.min.y <= other.max.y && box.max.y >= other.min.y
+                && box.min.z <= other.max.z && box.max.z >= other.min.z) {
+                pairs.push_back(make_pair(order[a], order[b]));
+            }
+        }
+    }
+}
+
+// Spatial hash
+
+// Boxes spanning more cells than this are tested against everything instead
+static const int max_cells_per_box = 64;
+
+glm::ivec3 SpatialHash::cell_of(const glm::vec3& point) const {
+    return glm::ivec3(glm::floor(point / cell_size));
+}
+
+// Cell coordinates packed into 21 bits each, exact within a million cells from the origin
+static uint64_t cell_key(const glm::ivec3& cell) {
+    const uint64_t mask = (uint64_t(1) << 21) - 1;
+    return ((uint64_t(cell.x + (1 << 20)) & mask) << 42)
+         | ((uint64_t(cell.y + (1 << 20)) & mask) << 21)
+         | (uint64_t(cell.z + (1 << 20)) & mask);
+}
+
+void SpatialHash::update(const BBox* boxes, size_t count) {
+    this->boxes = boxes;
+    this->count = count;
+
+    if (auto_cell_size && count > 0) {
+        float extent = 0.0f;
+        for (size_t i = 0; i < count; i++) {
+            const auto size = boxes[i].max - boxes[i].min;
+            extent += std::max(size.x, std::max(size.y, size.z));
+        }
+        cell_size = std::max(2.0f * extent / float(count), 1e-3f);
+    }
+
+    entries.clear();
+    large.clear();
+    is_large.assign(count, 0);
+
+    for (size_t proxy = 0; proxy < count; proxy++) {
+        const auto first = cell_of(boxes[proxy].min);
+        const auto last = cell_of(boxes[proxy].max);
+        const auto cells = last - first + 1;
+
+        if (cells.x * cells.y * cells.z > max_cells_per_box) {
+            large.push_back(uint32_t(proxy));
+            is_large[proxy] = 1;
+            continue;
+        }
+
+        for (int z = first.z; z <= last.z; z++) {
+            for (int y = first.y; y <= last.y; y++) {
+                for (int x = first.x; x <= last.x; x++) {
+                    entries.push_back({cell_key(glm::ivec3(x, y, z)), uint32_t(proxy)});
+                }
+            }
+        }
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& first, const Entry& second) {
+        return first.cell < second.cell;
+    });
+}
+
+void SpatialHash::find_pairs(std::vector<BroadphasePair>& pairs) {
+    pairs.clear();
+
+    for (size_t begin = 0; begin < entries.size();) {
+        size_t end = begin + 1;
+        while (end < entries.size() && entries[end].cell == entries[begin].cell) {
+            end++;
+        }
+
+        for (size_t a = begin; a < end; a++) {
+            const auto& box = boxes[entries[a].proxy];
+            for (size_t b = a + 1; b < end; b++) {
+                const auto& other = boxes[entries[b].proxy];
+                if (!intersect(box, other)) continue;
+
+                // The overlap starts in exactly one cell
+                if (cell_key(cell_of(glm::max(box.min, other.min))) == entries[begin].cell) {
+                    pairs.push_back(make_pair(entries[a].proxy, entries[b].proxy));
+                }
+            }
+        }
+
+        begin = end;
+    }
+
+    for (const auto proxy : large) {
+        for (size_t other = 0; other < count; other++) {
+            if (other == proxy || (is_large[other] && other < proxy)) continue;
+
+            if (intersect(boxes[proxy], boxes[other])) {
+                pairs.push_back(make_pair(proxy, uint32_t(other)));
+            }
+        }
+    }
+}
+
+// Dynamic AABB tree
+
+static BBox merge(const BBox& first, const BBox& second) {
+    return BBox(glm::min(first.min, second.min), glm::max(first.max, second.max));
+}
+
+static float area(const BBox& box) {
+    const auto size = box.max - box.min;
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static bool contains(const BBox& outer, const BBox& inner) {
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+        && outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+uint32_t AabbTree::allocate() {
+    if (!free_nodes.empty()) {
+        const uint32_t node = free_nodes.back();
+        free_nodes.pop_back();
+        return node;
+    }
+    nodes.push_back(Node());
+    return uint32_t(nodes.size() - 1);
+}
+
+void AabbTree::insert(uint32_t leaf) {
+    nodes[leaf].left = null_node;
+    nodes[leaf].right = null_node;
+
+    if (root == null_node) {
+        root = leaf;
+        nodes[leaf].parent = null_node;
+        return;
+    }
+
+    // Descend to the sibling with the smallest increase of the total surface area
+    const BBox box = nodes[leaf].box;
+    uint32_t sibling = root;
+    while (nodes[sibling].left != null_node) {
+        const auto& node = nodes[sibling];
+        const float combined = area(merge(node.box, box));
+        const float cost = 2.0f * combined;
+        const float inheritance = 2.0f * (combined - area(node.box));
+
+        float child_costs[2];
+        const uint32_t children[2] = {node.left, node.right};
+        for (int i = 0; i < 2; i++) {
+            const auto& child = nodes[children[i]];
+            const float enlarged = area(merge(child.box, box));
+            child_costs[i] = inheritance + (child.left == null_node ? enlarged : enlarged - area(child.box));
+        }
+
+        if (cost < child_costs[0] && cost < child_costs[1]) break;
+        sibling = child_costs[0] < child_costs[1] ? children[0] : children[1];
+    }
+
+    const uint32_t old_parent = nodes[sibling].parent;
+    const uint32_t parent = allocate();
+    nodes[parent].parent = old_parent;
+    nodes[parent].box = merge(box, nodes[sibling].box);
+    nodes[parent].left = sibling;
+    nodes[parent].right = leaf;
+    nodes[parent].proxy = 0;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+
+    if (old_parent == null_node) {
+        root = parent;
+    } else if (nodes[old_parent].left == sibling) {
+        nodes[old_parent].left = parent;
+    } else {
+        nodes[old_parent].right = parent;
+    }
+
+    for (uint32_t node = old_parent; node != null_node; node = nodes[node].parent) {
+        nodes[node].box = merge(nodes[nodes[node].left].box, nodes[nodes[node].right].box);
+    }
+}
+
+void AabbTree::remove(uint32_t leaf) {
+    if (leaf == root) {
+        root = null_node;
+        return;
+    }
+
+    const uint32_t parent = nodes[leaf].parent;
+    const uint32_t grandparent = nodes[parent].parent;
+    const uint32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+    free_nodes.push_back(parent);
+    nodes[sibling].parent = grandparent;
+
+    if (grandparent == null_node) {
+        root = sibling;
+        return;
+    }
+
+    if (nodes[grandparent].left == parent) {
+        nodes[grandparent].left = sibling;
+    } else {
+        nodes[grandparent].right = sibling;
+    }
+
+    for (uint32_t node = grandparent; node != null_node; node = nodes[node].parent) {
+        nodes[node].box = merge(nodes[nodes[node].left].box, nodes[nodes[node].right].box);
+    }
+}
+
+// Ticks of motion covered by the enlarged box
+static const float predicted_ticks = 4.0f;
+
+BBox AabbTree::enlarge(const BBox& box, const glm::vec3& displacement) const {
+    const auto stretch = predicted_ticks * displacement;
+    return BBox(box.min - margin + glm::min(stretch, glm::vec3(0.0f)), box.max + margin + glm::max(stretch, glm::vec3(0.0f)));
+}
+
+void AabbTree::update(const BBox* boxes, size_t count) {
+    this->boxes = boxes;
+
+    while (leaves.size() > count) {
+        remove(leaves.back());
+        free_nodes.push_back(leaves.back());
+        leaves.pop_back();
+    }
+    previous_min.resize(leaves.size());
+    moved.assign(count, 0);
+
+    for (size_t proxy = 0; proxy < leaves.size(); proxy++) {
+        const uint32_t leaf = leaves[proxy];
+        const auto displacement = boxes[proxy].min - previous_min[proxy];
+        previous_min[proxy] = boxes[proxy].min;
+        if (contains(nodes[leaf].box, boxes[proxy])) continue;
+
+        moved[proxy] = 1;
+        remove(leaf);
+        // A box swapped in from another proxy jumps far, it gets no stretch
+        const bool teleported = glm::length(displacement) > boxes[proxy].max.x - boxes[proxy].min.x + margin;
+        nodes[leaf].box = enlarge(boxes[proxy], teleported ? glm::vec3(0.0f) : displacement);
+        insert(leaf);
+    }
+
+    while (leaves.size() < count) {
+        const uint32_t leaf = allocate();
+        const auto proxy = uint32_t(leaves.size());
+        nodes[leaf].box = enlarge(boxes[proxy], glm::vec3(0.0f));
+        nodes[leaf].proxy = proxy;
+        insert(leaf);
+        leaves.push_back(leaf);
+        previous_min.push_back(boxes[proxy].min);
+        moved[proxy] = 1;
+    }
+}
+
+void AabbTree::find_pairs(std::vector<BroadphasePair>& pairs) {
+    pairs.clear();
+
+    // Enlarged boxes of the other proxies didn't change, neither did their pairs
+    const auto count = uint32_t(leaves.size());
+    enlarged_pairs.erase(std::remove_if(enlarged_pairs.begin(), enlarged_pairs.end(), [this, count](const BroadphasePair& pair) {
+        return pair.second >= count || moved[pair.first] || moved[pair.second];
+    }), enlarged_pairs.end());
+
+    for (uint32_t proxy = 0; proxy < count && root != null_node; proxy++) {
+        if (!moved[proxy]) continue;
+
+        const auto& box = nodes[leaves[proxy]].box;
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            const auto& node = nodes[stack.back()];
+            stack.pop_back();
+
+            if (!intersect(node.box, box)) continue;
+
+            if (node.left == null_node) {
+                // Two moved proxies find each other, keep one
+                if (node.proxy != proxy && (!moved[node.proxy] || node.proxy > proxy)) {
+                    enlarged_pairs.push_back(make_pair(proxy, node.proxy));
+                }
+            } else {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+    }
+
+    for (const auto& pair : enlarged_pairs) {
+        if (intersect(boxes[pair.first], boxes[pair.second])) {
+            pairs.push_back(pair);
+        }
+    }
+}
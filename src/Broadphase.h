@@ -0,0 +1,141 @@
+#ifndef SPACEOBJECTS_BROADPHASE_H
+#define SPACEOBJECTS_BROADPHASE_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "BBox.h"
+
+// Two proxies with overlapping boxes, first < second
+struct BroadphasePair {
+    uint32_t first;
+    uint32_t second;
+};
+
+enum class BroadphaseType {
+    SWEEP_AND_PRUNE,
+    SPATIAL_HASH,
+    AABB_TREE,
+    COUNT
+};
+
+// Finds the overlapping pairs among a set of moving boxes once per tick.
+// Proxies are the positions in the box array given to update, the array may grow,
+// shrink and reorder between ticks. Backends keep state between ticks to profit
+// from the small movement of one step.
+class Broadphase {
+public:
+    virtual ~Broadphase() = default;
+
+    virtual const char* name() const = 0;
+
+    virtual void update(const BBox* boxes, size_t count) = 0;
+
+    // Pairs of the last update, each one reported once, in no particular order
+    virtual void find_pairs(std::vector<BroadphasePair>& pairs) = 0;
+
+    static std::unique_ptr<Broadphase> create(BroadphaseType type);
+};
+
+// Boxes sorted by their minimum along x, sorted again each tick with an insertion sort
+// which is close to linear for coherent motion, then swept for overlaps
+class SweepAndPrune : public Broadphase {
+    const BBox* boxes = nullptr;
+    size_t count = 0;
+    std::vector<uint32_t> order;
+
+public:
+    const char* name() const override {
+        return "sweep and prune";
+    }
+
+    void update(const BBox* boxes, size_t count) override;
+
+    void find_pairs(std::vector<BroadphasePair>& pairs) override;
+};
+
+// Uniform grid hashed into a flat array of (cell, proxy) entries sorted by cell.
+// A pair is reported only in the cell holding the maximum of the two box minimums,
+// so pairs sharing several cells are not duplicated. Boxes covering too many cells
+// are kept aside and tested against everything
+class SpatialHash : public Broadphase {
+    struct Entry {
+        uint64_t cell;
+        uint32_t proxy;
+    };
+
+    const BBox* boxes = nullptr;
+    size_t count = 0;
+    float cell_size;
+    bool auto_cell_size;
+
+    std::vector<Entry> entries;
+    std::vector<uint32_t> large;
+    std::vector<uint8_t> is_large;
+
+    glm::ivec3 cell_of(const glm::vec3& point) const;
+
+public:
+    // Cell size 0 picks twice the average box extent on every update
+    explicit SpatialHash(float cell_size = 0.0f) : cell_size(cell_size), auto_cell_size(cell_size <= 0.0f) {}
+
+    const char* name() const override {
+        return "spatial hash";
+    }
+
+    void update(const BBox* boxes, size_t count) override;
+
+    void find_pairs(std::vector<BroadphasePair>& pairs) override;
+};
+
+// Dynamic bounding volume tree over enlarged boxes, as in Box2D and Bullet.
+// Boxes are enlarged by a margin and stretched along their last displacement, a proxy
+// is reinserted only when its box leaves the enlarged one. Insertion picks the sibling
+// by the surface area cost. Pairs of overlapping enlarged boxes are kept between ticks,
+// only the reinserted proxies query the tree for new ones
+class AabbTree : public Broadphase {
+    static constexpr uint32_t null_node = UINT32_MAX;
+
+    struct Node {
+        BBox box;
+        uint32_t parent;
+        uint32_t left;    // null_node for leaves
+        uint32_t right;
+        uint32_t proxy;   // Leaves only
+    };
+
+    const BBox* boxes = nullptr;
+    float margin;
+
+    std::vector<Node> nodes;
+    std::vector<uint32_t> free_nodes;
+    std::vector<uint32_t> leaves;  // Leaf of every proxy
+    std::vector<glm::vec3> previous_min;  // Box minimum at the last update, for the displacement
+    std::vector<uint8_t> moved;           // Reinserted by the last update
+    std::vector<BroadphasePair> enlarged_pairs;
+    uint32_t root = null_node;
+    std::vector<uint32_t> stack;
+
+    uint32_t allocate();
+
+    void insert(uint32_t leaf);
+
+    void remove(uint32_t leaf);
+
+    BBox enlarge(const BBox& box, const glm::vec3& displacement) const;
+
+public:
+    // Boxes are enlarged by `margin` on every side
+    explicit AabbTree(float margin = 0.2f) : margin(margin) {}
+
+    const char* name() const override {
+        return "AABB tree";
+    }
+
+    void update(const BBox* boxes, size_t count) override;
+
+    void find_pairs(std::vector<BroadphasePair>& pairs) override;
+};
+
+#endif //SPACEOBJECTS_BROADPHASE_H
@@ -32,6 +32,15 @@ struct Camera {
     }
 
     glm::mat4 getViewTransform() const {
+        return getViewTransform(position);
+    }
+
+    // Eye relative to the position, the local transform of a camera attached to a node placed there
+    glm::mat4 getEyeTransform() const {
+        return glm::translate(glm::mat4(1.0f), -position) * glm::inverse(getViewTransform());
+    }
+
+    glm::mat4 getViewTransform(const glm::vec3& position) const {
         if (mode == CameraMode::FIRST_PERSON) {
             const auto tmp_position = position + glm::vec3(0.0f, 0.5f, -1.0f);
             return glm::lookAt(tmp_position, rot * (tmp_position + direction), rot * up);
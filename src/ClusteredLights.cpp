@@ -0,0 +1,168 @@
+#include "ClusteredLights.h"
+
+#include <algorithm>
+#include <cmath>
+
+void LightClusters::init(float near_plane, float far_plane) {
+    this->near_plane = near_plane;
+    this->far_plane = far_plane;
+
+    static const GLenum formats[BUFFER_COUNT] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+
+    glGenBuffers(BUFFER_COUNT, buffers);
+    glGenTextures(BUFFER_COUNT, textures);
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    GL_CHECK_ERRORS;
+
+    ranges.resize(2 * cluster_count);
+    cursors.resize(cluster_count);
+}
+
+int LightClusters::slice(float depth) const {
+    const float scale = float(grid_z) / std::log(far_plane / near_plane);
+    const int index = int(std::floor(std::log(std::max(depth, near_plane) / near_plane) * scale));
+    return std::min(std::max(index, 0), grid_z - 1);
+}
+
+void LightClusters::upload(Buffer buffer, const void* data, size_t size) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[buffer]);
+    // Orphan the storage of the previous frame, the buffer is never empty to keep the texture valid
+    glBufferData(GL_TEXTURE_BUFFER, GLsizeiptr(std::max<size_t>(size, 16)), nullptr, GL_STREAM_DRAW);
+    if (size > 0) {
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, GLsizeiptr(size), data);
+    }
+}
+
+void LightClusters::build(const FrameVector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection) {
+    const size_t count = std::min(lights.size(), max_lights);
+
+    stats = Stats();
+    stats.lights = count;
+
+    light_data.resize(2 * count);
+    light_bounds.resize(2 * count);
+    std::fill(cursors.begin(), cursors.end(), 0);
+
+    // Cluster bounds of every light, counting the references per cluster on the way
+    for (size_t i = 0; i < count; i++) {
+        const auto& light = lights[i];
+        light_data[2 * i] = glm::vec4(light.position, light.radius);
+        light_data[2 * i + 1] = glm::vec4(light.color, light.intensity);
+
+        const auto center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        const float nearest = -center.z - light.radius;
+        const float farthest = -center.z + light.radius;
+
+        auto& low = light_bounds[2 * i];
+        auto& high = light_bounds[2 * i + 1];
+
+        if (farthest < near_plane || nearest > far_plane) {
+            low = glm::ivec3(1);  // Empty range
+            high = glm::ivec3(0);
+            continue;
+        }
+        low.z = slice(nearest);
+        high.z = slice(farthest);
+
+        // Screen rectangle of the view space box around the sphere.
+        // A box reaching behind the camera may project anywhere
+        low.x = 0;
+        low.y = 0;
+        high.x = grid_x - 1;
+        high.y = grid_y - 1;
+        if (nearest > near_plane) {
+            glm::vec2 ndc_min(1.0f), ndc_max(-1.0f);
+            for (int corner = 0; corner < 8; corner++) {
+                const auto offset = glm::vec3(
+                    (corner & 1) ? light.radius : -light.radius,
+                    (corner & 2) ? light.radius : -light.radius,
+                    (corner & 4) ? light.radius : -light.radius
+                );
+                const auto clip = projection * glm::vec4(center + offset, 1.0f);
+                const auto ndc = glm::vec2(clip) / clip.w;
+                ndc_min = glm::min(ndc_min, ndc);
+                ndc_max = glm::max(ndc_max, ndc);
+            }
+
+            if (ndc_max.x < -1.0f || ndc_min.x > 1.0f || ndc_max.y < -1.0f || ndc_min.y > 1.0f) {
+                low = glm::ivec3(1);
+                high = glm::ivec3(0);
+                continue;
+            }
+
+            low.x = std::max(int(std::floor((0.5f * ndc_min.x + 0.5f) * grid_x)), 0);
+            low.y = std::max(int(std::floor((0.5f * ndc_min.y + 0.5f) * grid_y)), 0);
+            high.x = std::min(int(std::floor((0.5f * ndc_max.x + 0.5f) * grid_x)), grid_x - 1);
+            high.y = std::min(int(std::floor((0.5f * ndc_max.y + 0.5f) * grid_y)), grid_y - 1);
+        }
+
+        for (int z = low.z; z <= high.z; z++) {
+            for (int y = low.y; y <= high.y; y++) {
+                for (int x = low.x; x <= high.x; x++) {
+                    cursors[x + grid_x * (y + grid_y * z)]++;
+                }
+            }
+        }
+    }
+
+    // Prefix sum gives the start of every cluster in the index list
+    uint32_t offset = 0;
+    for (int cluster = 0; cluster < cluster_count; cluster++) {
+        ranges[2 * cluster] = offset;
+        ranges[2 * cluster + 1] = cursors[cluster];
+        stats.max_per_cluster = std::max<size_t>(stats.max_per_cluster, cursors[cluster]);
+
+        offset += cursors[cluster];
+        cursors[cluster] = ranges[2 * cluster];
+    }
+    stats.references = offset;
+
+    indices.resize(offset);
+    for (size_t i = 0; i < count; i++) {
+        const auto& low = light_bounds[2 * i];
+        const auto& high = light_bounds[2 * i + 1];
+
+        for (int z = low.z; z <= high.z; z++) {
+            for (int y = low.y; y <= high.y; y++) {
+                for (int x = low.x; x <= high.x; x++) {
+                    indices[cursors[x + grid_x * (y + grid_y * z)]++] = uint32_t(i);
+                }
+            }
+        }
+    }
+
+    upload(LIGHT_DATA, light_data.data(), light_data.size() * sizeof(glm::vec4));
+    upload(CLUSTER_RANGES, ranges.data(), ranges.size() * sizeof(uint32_t));
+    upload(LIGHT_INDICES, indices.data(), indices.size() * sizeof(uint32_t));
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    GL_CHECK_ERRORS;
+}
+
+void LightClusters::bind(int unit) const {
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        glActiveTexture(GLenum(GL_TEXTURE0 + unit + i));
+        glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::unbind(int unit) const {
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        glActiveTexture(GLenum(GL_TEXTURE0 + unit + i));
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void LightClusters::set_uniforms(const ShaderProgram& program) const {
+    program.SetUniform("cluster_grid", glm::vec3(grid_x, grid_y, grid_z));
+    program.SetUniform("cluster_depth", glm::vec2(near_plane, float(grid_z) / std::log(far_plane / near_plane)));
+}
@@ -0,0 +1,86 @@
+#ifndef SPACEOBJECTS_CLUSTEREDLIGHTS_H
+#define SPACEOBJECTS_CLUSTEREDLIGHTS_H
+
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "FrameArena.h"
+#include "ShaderProgram.h"
+
+struct PointLight {
+    glm::vec3 position;  // World space
+    float radius;        // No contribution beyond it
+    glm::vec3 color;
+    float intensity;
+};
+
+// Bins point lights into a view space grid of clusters: screen tiles split into
+// exponential depth slices. The lights, the light ranges of the clusters and the
+// light indices are uploaded as texture buffers, so a fragment only loops over
+// the lights of its own cluster.
+class LightClusters {
+public:
+    static constexpr int grid_x = 16;
+    static constexpr int grid_y = 9;
+    static constexpr int grid_z = 24;
+    static constexpr int cluster_count = grid_x * grid_y * grid_z;
+
+    struct Stats {
+        size_t lights = 0;
+        size_t references = 0;       // Light indices over all clusters
+        size_t max_per_cluster = 0;
+    };
+
+private:
+    enum Buffer {
+        LIGHT_DATA,      // RGBA32F, two texels per light: position and radius, color and intensity
+        CLUSTER_RANGES,  // RG32UI, offset and count of the cluster indices
+        LIGHT_INDICES,   // R32UI
+        BUFFER_COUNT
+    };
+
+    GLuint buffers[BUFFER_COUNT] = {};
+    GLuint textures[BUFFER_COUNT] = {};
+
+    float near_plane = 0.1f;
+    float far_plane = 100.0f;
+
+    std::vector<glm::vec4> light_data;
+    std::vector<glm::ivec3> light_bounds;  // First and last cluster of every light along each axis
+    std::vector<uint32_t> ranges;
+    std::vector<uint32_t> cursors;
+    std::vector<uint32_t> indices;
+
+    Stats stats;
+
+    int slice(float depth) const;
+
+    void upload(Buffer buffer, const void* data, size_t size);
+
+public:
+    size_t max_lights = 1024;
+
+    LightClusters() = default;
+
+    void init(float near_plane, float far_plane);
+
+    // Assign the lights to the clusters of the given camera and upload the result
+    void build(const FrameVector<PointLight>& lights, const glm::mat4& view, const glm::mat4& projection);
+
+    // Bind the texture buffers to three units starting with `unit`
+    void bind(int unit) const;
+
+    void unbind(int unit) const;
+
+    // Grid parameters used by the shaders to find the cluster of a fragment
+    void set_uniforms(const ShaderProgram& program) const;
+
+    const Stats& get_stats() const {
+        return stats;
+    }
+};
+
+#endif //SPACEOBJECTS_CLUSTEREDLIGHTS_H
@@ -0,0 +1,67 @@
+#include "DynamicResolution.h"
+
+#include <cmath>
+
+void DynamicResolution::init() {
+    glGenQueries(queries_in_flight, queries.data());
+    GL_CHECK_ERRORS;
+}
+
+void DynamicResolution::begin() {
+    // Skip the measurement if all queries are still waiting for the GPU
+    timing = issued - resolved < queries_in_flight;
+    if (timing) {
+        glBeginQuery(GL_TIME_ELAPSED, queries[issued % queries_in_flight]);
+    }
+}
+
+void DynamicResolution::end() {
+    if (timing) {
+        glEndQuery(GL_TIME_ELAPSED);
+        issued++;
+        timing = false;
+    }
+}
+
+void DynamicResolution::update() {
+    while (resolved < issued) {
+        const GLuint query = queries[resolved % queries_in_flight];
+
+        GLint available = GL_FALSE;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available == GL_FALSE) {
+            break;
+        }
+
+        GLuint64 elapsed;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        resolved++;
+
+        adjust(float(double(elapsed) * 1e-6));
+    }
+}
+
+void DynamicResolution::adjust(float sample) {
+    gpu_time = gpu_time == 0.0f ? sample : gpu_time + 0.1f * (sample - gpu_time);
+
+    if (settle > 0) {
+        settle--;
+        return;
+    }
+
+    float wanted = max_scale;
+    if (enabled && gpu_time > 0.0f) {
+        // The cost of the passes is roughly proportional to the number of pixels
+        wanted = scale * std::sqrt(target_time / gpu_time);
+    }
+    wanted = std::min(std::max(std::floor(wanted / scale_step + 1e-3f) * scale_step, min_scale), max_scale);
+
+    if (std::fabs(wanted - scale) < 0.5f * scale_step) {
+        return;
+    }
+
+    // Predict the time at the new scale so that the next decision doesn't overshoot
+    gpu_time *= (wanted * wanted) / (scale * scale);
+    scale = wanted;
+    settle = settle_frames;
+}
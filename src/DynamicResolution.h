@@ -0,0 +1,61 @@
+#ifndef SPACEOBJECTS_DYNAMICRESOLUTION_H
+#define SPACEOBJECTS_DYNAMICRESOLUTION_H
+
+#include <algorithm>
+#include <array>
+#include <glad/glad.h>
+
+#include "common.h"
+
+// Picks the render resolution of the scene from the GPU time of its passes.
+// Timer queries are read back a few frames later without waiting for the GPU.
+// The scale moves in fixed steps and settles between changes, so render targets
+// of the same size keep being reused instead of reallocated every frame.
+class DynamicResolution {
+    static constexpr int queries_in_flight = 4;
+
+    std::array<GLuint, queries_in_flight> queries;
+    int issued = 0;
+    int resolved = 0;
+    bool timing = false;
+
+    float scale = 1.0f;
+    float gpu_time = 0.0f;  // Smoothed, in milliseconds
+    int settle = 0;
+
+    void adjust(float sample);
+
+public:
+    float target_time = 12.0f;  // Budget of the scaled passes in milliseconds
+    float min_scale = 0.5f;
+    float max_scale = 1.0f;
+    float scale_step = 0.05f;
+    int settle_frames = 30;     // Samples to wait after a change
+    bool enabled = true;
+
+    DynamicResolution() = default;
+
+    void init();
+
+    // Bracket the passes rendered at the scaled resolution
+    void begin();
+
+    void end();
+
+    // Collect finished measurements and pick the scale for the next frame
+    void update();
+
+    float get_scale() const {
+        return scale;
+    }
+
+    float get_gpu_time() const {
+        return gpu_time;
+    }
+
+    GLsizei scaled(GLsizei size) const {
+        return std::max(GLsizei(float(size) * scale), 1);
+    }
+};
+
+#endif //SPACEOBJECTS_DYNAMICRESOLUTION_H
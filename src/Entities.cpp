@@ -0,0 +1,176 @@
+#include "Entities.h"
+
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+
+// Boxes per job of the bounds update, smaller batches cost more to schedule than they save
+static const size_t bounds_grain = 1024;
+
+void EntityStore::reserve(size_t count) {
+    positions.reserve(count);
+    prev_positions.reserve(count);
+    orientations.reserve(count);
+    velocities.reserve(count);
+    health.reserve(count);
+    death_countdowns.reserve(count);
+    transient.reserve(count);
+    models.reserve(count);
+    local_bounds.reserve(count);
+    world_transforms.reserve(count);
+    bounds.reserve(count);
+    nodes.reserve(count);
+    dense_slots.reserve(count);
+    transform_dirty.reserve(count);
+    slots.reserve(count);
+    free_slots.reserve(count);
+    reserved = std::max(reserved, count);
+}
+
+Entity EntityStore::create(const Model* model, const BBox& local_bounds, const glm::vec3& position,
+                           const glm::mat4& orientation, const glm::vec3& velocity, float health) {
+    uint32_t slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        slot = uint32_t(slots.size());
+        slots.push_back({0, 0});
+    }
+    slots[slot].dense = uint32_t(positions.size());
+
+    const auto local = glm::translate(glm::mat4(1.0f), position) * orientation;
+
+    positions.push_back(position);
+    prev_positions.push_back(position);
+    orientations.push_back(orientation);
+    velocities.push_back(velocity);
+    this->health.push_back(health);
+    death_countdowns.push_back(-1);
+    transient.push_back(0);
+    models.push_back(model);
+    this->local_bounds.push_back(local_bounds);
+    world_transforms.push_back(local);
+    bounds.push_back(local_bounds.transformed(local));
+    nodes.push_back(hierarchy != nullptr ? hierarchy->create(local) : TransformHierarchy::none);
+    dense_slots.push_back(slot);
+    transform_dirty.push_back(0);
+
+    return {slot, slots[slot].generation};
+}
+
+void EntityStore::remove(Entity entity) {
+    if (!alive(entity)) {
+        return;
+    }
+
+    const size_t hole = slots[entity.index].dense;
+    const size_t last = positions.size() - 1;
+
+    if (hierarchy != nullptr) {
+        hierarchy->destroy(nodes[hole]);
+    }
+
+    // Fill the hole with the last entity to keep the arrays dense
+    if (hole != last) {
+        positions[hole] = positions[last];
+        prev_positions[hole] = prev_positions[last];
+        orientations[hole] = orientations[last];
+        velocities[hole] = velocities[last];
+        health[hole] = health[last];
+        death_countdowns[hole] = death_countdowns[last];
+        transient[hole] = transient[last];
+        models[hole] = models[last];
+        local_bounds[hole] = local_bounds[last];
+        world_transforms[hole] = world_transforms[last];
+        bounds[hole] = bounds[last];
+        nodes[hole] = nodes[last];
+        dense_slots[hole] = dense_slots[last];
+        transform_dirty[hole] = transform_dirty[last];
+
+        slots[dense_slots[hole]].dense = uint32_t(hole);
+    }
+
+    positions.pop_back();
+    prev_positions.pop_back();
+    orientations.pop_back();
+    velocities.pop_back();
+    health.pop_back();
+    death_countdowns.pop_back();
+    transient.pop_back();
+    models.pop_back();
+    local_bounds.pop_back();
+    world_transforms.pop_back();
+    bounds.pop_back();
+    nodes.pop_back();
+    dense_slots.pop_back();
+    transform_dirty.pop_back();
+
+    // Old handles of the slot stop being alive
+    slots[entity.index].generation++;
+    free_slots.push_back(entity.index);
+}
+
+void EntityStore::store_state() {
+    for (size_t i = 0; i < size(); i++) {
+        prev_positions[i] = glm::vec3(world_transforms[i][3]);
+    }
+}
+
+void EntityStore::integrate(float steps) {
+    for (size_t i = 0; i < size(); i++) {
+        if (velocities[i] != glm::vec3(0.0f)) {
+            positions[i] += steps * velocities[i];
+            transform_dirty[i] = 1;
+        }
+    }
+}
+
+void EntityStore::update_transforms(WorkerPool* workers) {
+    for (size_t i = 0; i < size(); i++) {
+        if (!transform_dirty[i]) continue;
+
+        const auto local = glm::translate(glm::mat4(1.0f), positions[i]) * orientations[i];
+        if (nodes[i] != TransformHierarchy::none) {
+            hierarchy->set_local(nodes[i], local);
+        } else {
+            world_transforms[i] = local;
+        }
+        transform_dirty[i] = 0;
+    }
+
+    if (hierarchy != nullptr) {
+        hierarchy->update();
+        for (size_t i = 0; i < size(); i++) {
+            if (hierarchy->was_changed(nodes[i])) {
+                world_transforms[i] = hierarchy->get_world(nodes[i]);
+            }
+        }
+    }
+
+    // Cheaper to redo all of them with SIMD than to track which ones changed
+    auto update_bounds = [this](size_t begin, size_t end, int) {
+        transform_bboxes(local_bounds.data() + begin, world_transforms.data() + begin, bounds.data() + begin, end - begin);
+    };
+    if (workers != nullptr) {
+        workers->parallel_for(size(), bounds_grain, update_bounds);
+    } else {
+        update_bounds(0, size(), 0);
+    }
+}
+
+size_t EntityStore::update_dying() {
+    size_t removed = 0;
+    for (size_t i = 0; i < size();) {
+        if (death_countdowns[i] > 0) {
+            death_countdowns[i]--;
+        }
+        if (death_countdowns[i] == 0) {
+            // The last entity moves here and is visited next
+            remove(handle(i));
+            removed++;
+        } else {
+            i++;
+        }
+    }
+    return removed;
+}
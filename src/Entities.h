@@ -0,0 +1,142 @@
+#ifndef SPACEOBJECTS_ENTITIES_H
+#define SPACEOBJECTS_ENTITIES_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "BBox.h"
+#include "TransformHierarchy.h"
+#include "WorkerPool.h"
+
+class Model;
+
+// Stable reference to an entity. The generation tells a removed entity from a new one reusing its slot
+struct Entity {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+
+    Entity() = default;
+
+    Entity(uint32_t index, uint32_t generation) : index(index), generation(generation) {}
+
+    bool operator==(const Entity& other) const {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const Entity& other) const {
+        return !(*this == other);
+    }
+};
+
+// Entities of the game in structure of arrays layout.
+// Components are dense arrays with one element per live entity, so systems run over
+// contiguous memory. Handles map to the dense position through a slot table,
+// removal moves the last entity into the hole.
+// With a hierarchy every entity gets a node, so parts can be attached to it.
+class EntityStore {
+public:
+    static constexpr int death_duration = 60;  // Steps between the fatal hit and the removal
+
+    // Components, index is the dense position of an entity
+    std::vector<glm::vec3> positions;      // Local, relative to the parent node if attached
+    std::vector<glm::vec3> prev_positions; // World, at the previous simulation step
+    std::vector<glm::mat4> orientations;   // Rotation and scale
+    std::vector<glm::vec3> velocities;     // Per simulation step
+    std::vector<float> health;             // Hit points, lowered by the contact damage of other models
+    std::vector<int> death_countdowns;     // Negative while alive
+    std::vector<uint8_t> transient;        // Set by the owner for entities recycled once they leave the scene
+    std::vector<const Model*> models;      // Render handle: shared meshes and local bounds
+    std::vector<BBox> local_bounds;
+    std::vector<glm::mat4> world_transforms;
+    std::vector<BBox> bounds;              // World space
+    std::vector<TransformHierarchy::Node> nodes;  // `none` without a hierarchy
+
+private:
+    TransformHierarchy* hierarchy;
+
+    struct Slot {
+        uint32_t dense;
+        uint32_t generation;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> free_slots;
+    std::vector<uint32_t> dense_slots;     // Slot of every dense entity
+    std::vector<uint8_t> transform_dirty;
+    size_t reserved = 0;
+
+public:
+    explicit EntityStore(TransformHierarchy* hierarchy = nullptr) : hierarchy(hierarchy) {}
+
+    EntityStore(const EntityStore&) = delete;
+    EntityStore& operator=(const EntityStore&) = delete;
+
+    // Fixed capacity pool: up to `count` entities are created and removed without allocating,
+    // new entities recycle the slots of removed ones. The nodes of the hierarchy are reserved by its owner
+    void reserve(size_t count);
+
+    size_t capacity() const {
+        return reserved;
+    }
+
+    // The model is not owned and has to outlive the entity
+    Entity create(const Model* model, const BBox& local_bounds, const glm::vec3& position,
+                  const glm::mat4& orientation = glm::mat4(1.0f), const glm::vec3& velocity = glm::vec3(0.0f),
+                  float health = 100.0f);
+
+    void remove(Entity entity);
+
+    bool alive(Entity entity) const {
+        return entity.index < slots.size() && slots[entity.index].generation == entity.generation;
+    }
+
+    // Dense position of a live entity, valid until the next removal
+    size_t index(Entity entity) const {
+        return slots[entity.index].dense;
+    }
+
+    Entity handle(size_t index) const {
+        const uint32_t slot = dense_slots[index];
+        return {slot, slots[slot].generation};
+    }
+
+    size_t size() const {
+        return positions.size();
+    }
+
+    void set_position(size_t index, const glm::vec3& position) {
+        positions[index] = position;
+        transform_dirty[index] = 1;
+    }
+
+    glm::vec3 get_world_position(size_t index) const {
+        return glm::vec3(world_transforms[index][3]);
+    }
+
+    bool dying(size_t index) const {
+        return death_countdowns[index] >= 0;
+    }
+
+    // Remember the world positions of the previous step for interpolation
+    void store_state();
+
+    // Move every entity by its velocity
+    void integrate(float steps = 1.0f);
+
+    // Recompute the world transforms of the moved entities through the hierarchy,
+    // and the world bounds of everything in one batch, split over the workers if given
+    void update_transforms(WorkerPool* workers = nullptr);
+
+    // Start the death countdown, the entity is removed by update_dying when it runs out
+    void kill(size_t index) {
+        if (!dying(index)) {
+            death_countdowns[index] = death_duration;
+        }
+    }
+
+    // Advance the death countdowns and remove the finished entities. Returns the number of removed ones
+    size_t update_dying();
+};
+
+#endif //SPACEOBJECTS_ENTITIES_H
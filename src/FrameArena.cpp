@@ -0,0 +1,65 @@
+#include "FrameArena.h"
+
+#include <algorithm>
+
+// Blocks grow in steps of this, so a slowly rising watermark doesn't reallocate every other frame
+static const size_t growth_granularity = 64 * 1024;
+
+static uint8_t* align_up(uint8_t* pointer, size_t alignment) {
+    const auto address = reinterpret_cast<uintptr_t>(pointer);
+    return pointer + ((alignment - address % alignment) % alignment);
+}
+
+FrameArena::FrameArena(size_t capacity) {
+    for (auto& buffer : buffers) {
+        buffer.memory.reset(new uint8_t[capacity]);
+        buffer.capacity = capacity;
+    }
+}
+
+void FrameArena::reset(Buffer& buffer) {
+    if (buffer.capacity < high_watermark) {
+        // Alignment padding is counted in the watermark, a block of its size fits the same frame again
+        buffer.capacity = (high_watermark + growth_granularity - 1) / growth_granularity * growth_granularity;
+        buffer.memory.reset(new uint8_t[buffer.capacity]);
+    }
+    buffer.used = 0;
+    buffer.overflow.clear();
+    buffer.overflow_bytes = 0;
+}
+
+void FrameArena::begin_frame() {
+    current = 1 - current;
+    reset(buffers[current]);
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment) {
+    auto& buffer = buffers[current];
+
+    const auto begin = buffer.memory.get() + buffer.used;
+    auto result = align_up(begin, alignment);
+    const auto end = result + size;
+
+    if (end <= buffer.memory.get() + buffer.capacity) {
+        buffer.used = size_t(end - buffer.memory.get());
+    } else {
+        overflows++;
+        buffer.overflow.emplace_back(new uint8_t[size + alignment]);
+        result = align_up(buffer.overflow.back().get(), alignment);
+        buffer.overflow_bytes += size + alignment;
+    }
+
+    high_watermark = std::max(high_watermark, buffer.used + buffer.overflow_bytes);
+    return result;
+}
+
+FrameArena::Stats FrameArena::get_stats() const {
+    const auto& buffer = buffers[current];
+
+    Stats stats;
+    stats.used = buffer.used + buffer.overflow_bytes;
+    stats.capacity = buffer.capacity;
+    stats.high_watermark = high_watermark;
+    stats.overflows = overflows;
+    return stats;
+}
@@ -0,0 +1,105 @@
+#ifndef SPACEOBJECTS_FRAMEARENA_H
+#define SPACEOBJECTS_FRAMEARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+// Linear allocator for data that lives for a frame: allocations bump an offset through a block
+// and are never freed one by one. Two blocks alternate between frames, starting a frame drops
+// everything allocated two frames ago at once, so the data of the previous frame stays readable.
+// When a frame doesn't fit its block the rest goes to the heap and the block grows to the
+// high watermark the next time it is reused. Not thread safe, every thread needs its own arena
+class FrameArena {
+public:
+    struct Stats {
+        size_t used = 0;            // Bytes allocated in the current frame
+        size_t capacity = 0;        // Of the block of the current frame
+        size_t high_watermark = 0;  // Most bytes any frame needed
+        size_t overflows = 0;       // Allocations which didn't fit their block
+    };
+
+private:
+    struct Buffer {
+        std::unique_ptr<uint8_t[]> memory;
+        size_t capacity = 0;
+        size_t used = 0;
+        std::vector<std::unique_ptr<uint8_t[]>> overflow;  // Blocks from the heap, freed with the frame
+        size_t overflow_bytes = 0;
+    };
+
+    Buffer buffers[2];
+    int current = 0;
+
+    size_t high_watermark = 0;
+    size_t overflows = 0;
+
+    void reset(Buffer& buffer);
+
+public:
+    explicit FrameArena(size_t capacity);
+
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+
+    // Switch to the other block and release what was allocated there
+    void begin_frame();
+
+    // Alignment has to be a power of two
+    void* allocate(size_t size, size_t alignment);
+
+    template<typename T>
+    T* allocate(size_t count) {
+        return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    Stats get_stats() const;
+};
+
+// Adapter for the standard containers. Deallocation does nothing, the memory comes back with the arena,
+// so a container must not outlive the frame after the one it was filled in.
+// Containers assigned from each other take the arena along
+template<typename T>
+class ArenaAllocator {
+    template<typename U>
+    friend class ArenaAllocator;
+
+    FrameArena* arena = nullptr;
+
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    // Can't allocate, for containers which get their storage assigned each frame
+    ArenaAllocator() = default;
+
+    ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        return arena->allocate<T>(count);
+    }
+
+    void deallocate(T*, size_t) {}
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const {
+        return arena != other.arena;
+    }
+};
+
+template<typename T>
+using FrameVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif //SPACEOBJECTS_FRAMEARENA_H
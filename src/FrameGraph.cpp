@@ -0,0 +1,376 @@
+#include "FrameGraph.h"
+
+#include <algorithm>
+#include <utility>
+
+FrameGraph::Resource FrameGraph::Builder::create(const char* name, const TextureDesc& desc) {
+    const Resource resource = Resource(graph.resources.size());
+    graph.resources.push_back({name, desc, false, 0, 0, -1, -1, FrameVector<int>(*graph.arena)});
+    return write(resource);
+}
+
+FrameGraph::Resource FrameGraph::Builder::read(Resource resource) {
+    graph.passes[pass].reads.push_back(resource);
+    return resource;
+}
+
+FrameGraph::Resource FrameGraph::Builder::write(Resource resource) {
+    auto& writes = graph.passes[pass].writes;
+    if (std::find(writes.begin(), writes.end(), resource) == writes.end()) {
+        writes.push_back(resource);
+        graph.resources[resource].writers.push_back(pass);
+    }
+    return resource;
+}
+
+void FrameGraph::Builder::clear(GLbitfield mask, const glm::vec4& color) {
+    graph.passes[pass].clear_mask = mask;
+    graph.passes[pass].clear_color = color;
+}
+
+void FrameGraph::Builder::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    graph.passes[pass].has_viewport = true;
+    graph.passes[pass].viewport = glm::ivec4(x, y, width, height);
+}
+
+void FrameGraph::Builder::side_effect() {
+    graph.passes[pass].side_effect = true;
+}
+
+void FrameGraph::reset(FrameArena& arena) {
+    this->arena = &arena;
+    resources.clear();
+    passes.clear();
+    order.clear();
+    stats = Stats();
+}
+
+FrameGraph::Resource FrameGraph::import_texture(const char* name, GLuint texture, const TextureDesc& desc) {
+    resources.push_back({name, desc, true, texture, 0, -1, -1, FrameVector<int>(*arena)});
+    return Resource(resources.size() - 1);
+}
+
+FrameGraph::Resource FrameGraph::import_backbuffer(const char* name, GLsizei width, GLsizei height) {
+    return import_texture(name, 0, TextureDesc(width, height, GL_RGBA8));
+}
+
+void FrameGraph::add_pass(const char* name,
+                          const std::function<void(Builder&)>& setup,
+                          const std::function<void(const FrameGraph&)>& execute) {
+    PassNode pass;
+    pass.name = name;
+    pass.reads = FrameVector<Resource>(*arena);
+    pass.writes = FrameVector<Resource>(*arena);
+    pass.execute = execute;
+    pass.clear_mask = 0;
+    pass.clear_color = glm::vec4(0.0f);
+    pass.has_viewport = false;
+    pass.viewport = glm::ivec4(0);
+    pass.side_effect = false;
+    pass.ref_count = 0;
+    passes.push_back(std::move(pass));
+
+    Builder builder(*this, int(passes.size() - 1));
+    setup(builder);
+}
+
+void FrameGraph::compile() {
+    for (auto& resource : resources) {
+        resource.ref_count = 0;
+        resource.first_use = -1;
+        resource.last_use = -1;
+    }
+
+    for (auto& pass : passes) {
+        pass.ref_count = int(pass.writes.size()) + (pass.side_effect ? 1 : 0);
+        for (const auto resource : pass.reads) {
+            resources[resource].ref_count++;
+        }
+    }
+
+    // Cull passes whose outputs are never read, walking back from unreferenced resources.
+    // Imported resources are always considered referenced
+    FrameVector<Resource> unreferenced(*arena);
+    for (int i = 0; i < int(resources.size()); i++) {
+        if (!resources[i].imported && resources[i].ref_count == 0) {
+            unreferenced.push_back(i);
+        }
+    }
+
+    while (!unreferenced.empty()) {
+        const auto resource = unreferenced.back();
+        unreferenced.pop_back();
+
+        for (const auto writer : resources[resource].writers) {
+            auto& pass = passes[writer];
+            if (--pass.ref_count != 0) continue;
+
+            for (const auto input : pass.reads) {
+                if (!resources[input].imported && --resources[input].ref_count == 0) {
+                    unreferenced.push_back(input);
+                }
+            }
+        }
+    }
+
+    // Resources can only be read after they were declared, so the declaration order
+    // of the remaining passes is already a valid execution order
+    for (int i = 0; i < int(passes.size()); i++) {
+        if (passes[i].ref_count > 0) {
+            order.push_back(i);
+        }
+    }
+
+    // Lifetimes of transient resources in terms of execution steps
+    for (int step = 0; step < int(order.size()); step++) {
+        const auto& pass = passes[order[step]];
+
+        for (const auto& list : {&pass.reads, &pass.writes}) {
+            for (const auto resource : *list) {
+                auto& node = resources[resource];
+                if (node.first_use == -1) {
+                    node.first_use = step;
+                }
+                node.last_use = std::max(node.last_use, step);
+            }
+        }
+    }
+
+    stats.passes = int(passes.size());
+    stats.culled = int(passes.size() - order.size());
+    for (const auto& resource : resources) {
+        if (!resource.imported && resource.first_use != -1) {
+            stats.transient++;
+        }
+    }
+}
+
+void FrameGraph::execute() {
+    frame++;
+
+    if (blit_framebuffer == 0) {
+        glGenFramebuffers(1, &blit_framebuffer);
+    }
+
+    for (int step = 0; step < int(order.size()); step++) {
+        const auto& pass = passes[order[step]];
+
+        for (const auto& list : {&pass.reads, &pass.writes}) {
+            for (const auto resource : *list) {
+                auto& node = resources[resource];
+                if (!node.imported && node.first_use == step && node.texture == 0) {
+                    node.texture = acquire(node.desc);
+                }
+            }
+        }
+
+        begin_pass(pass);
+        pass.execute(*this);
+        GL_CHECK_ERRORS;
+
+        for (const auto& list : {&pass.reads, &pass.writes}) {
+            for (const auto resource : *list) {
+                auto& node = resources[resource];
+                if (!node.imported && node.last_use == step && node.texture != 0) {
+                    release(node.texture);
+                }
+            }
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    evict_unused();
+    stats.physical = int(pool.size());
+}
+
+GLuint FrameGraph::acquire(const TextureDesc& desc) {
+    for (auto& entry : pool) {
+        if (!entry.in_use && entry.desc == desc) {
+            entry.in_use = true;
+            entry.last_frame = frame;
+            return entry.texture;
+        }
+    }
+
+    GLuint texture;
+    glGenTextures(1, &texture);
+
+    if (desc.samples > 0) {
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
+        glTexImage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, desc.samples, desc.format, desc.width, desc.height, GL_TRUE);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    } else {
+        GLenum format = GL_RGBA;
+        GLenum type = GL_UNSIGNED_BYTE;
+        if (desc.format == GL_DEPTH24_STENCIL8) {
+            format = GL_DEPTH_STENCIL;
+            type = GL_UNSIGNED_INT_24_8;
+        } else if (desc.format == GL_DEPTH32F_STENCIL8) {
+            format = GL_DEPTH_STENCIL;
+            type = GL_FLOAT_32_UNSIGNED_INT_24_8_REV;
+        } else if (desc.is_depth()) {
+            format = GL_DEPTH_COMPONENT;
+            type = GL_FLOAT;
+        }
+
+        const GLint filter = desc.is_depth() ? GL_NEAREST : GL_LINEAR;
+
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.format, desc.width, desc.height, 0, format, type, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    GL_CHECK_ERRORS;
+
+    pool.push_back({desc, texture, true, frame});
+    return texture;
+}
+
+void FrameGraph::release(GLuint texture) {
+    for (auto& entry : pool) {
+        if (entry.texture == texture) {
+            entry.in_use = false;
+            return;
+        }
+    }
+}
+
+void FrameGraph::evict_unused() {
+    for (size_t i = 0; i < pool.size();) {
+        const auto& entry = pool[i];
+        if (entry.in_use || frame - entry.last_frame <= max_unused_frames) {
+            i++;
+            continue;
+        }
+
+        for (auto it = framebuffers.begin(); it != framebuffers.end();) {
+            if (std::find(it->first.begin(), it->first.end(), entry.texture) != it->first.end()) {
+                glDeleteFramebuffers(1, &it->second);
+                it = framebuffers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        glDeleteTextures(1, &entry.texture);
+
+        pool[i] = pool.back();
+        pool.pop_back();
+    }
+}
+
+GLuint FrameGraph::get_framebuffer(const PassNode& pass) {
+    AttachmentKey key;
+    key.fill(0);
+
+    int colors = 0;
+    for (const auto resource : pass.writes) {
+        const auto& node = resources[resource];
+        if (node.desc.is_depth()) {
+            key[max_color_attachments] = node.texture;
+        } else if (colors < max_color_attachments) {
+            key[colors++] = node.texture;
+        }
+    }
+
+    // Passes writing only to the backbuffer
+    if (std::all_of(key.begin(), key.end(), [](GLuint texture) { return texture == 0; })) {
+        return 0;
+    }
+
+    const auto it = framebuffers.find(key);
+    if (it != framebuffers.end()) {
+        return it->second;
+    }
+
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    GLenum draw_buffers[max_color_attachments];
+    for (int i = 0; i < colors; i++) {
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, key[i], 0);
+        draw_buffers[i] = GL_COLOR_ATTACHMENT0 + i;
+    }
+
+    if (key[max_color_attachments] != 0) {
+        GLenum attachment = GL_DEPTH_ATTACHMENT;
+        for (const auto resource : pass.writes) {
+            const auto format = resources[resource].desc.format;
+            if (format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8) {
+                attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+            }
+        }
+        glFramebufferTexture(GL_FRAMEBUFFER, attachment, key[max_color_attachments], 0);
+    }
+
+    if (colors > 0) {
+        glDrawBuffers(colors, draw_buffers);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+    } else {
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+    }
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Framebuffer of pass " << pass.name << " is incomplete" << std::endl;
+    }
+    GL_CHECK_ERRORS;
+
+    framebuffers[key] = framebuffer;
+    return framebuffer;
+}
+
+void FrameGraph::begin_pass(const PassNode& pass) {
+    glBindFramebuffer(GL_FRAMEBUFFER, get_framebuffer(pass));
+
+    glm::ivec4 viewport = pass.viewport;
+    if (!pass.has_viewport && !pass.writes.empty()) {
+        const auto& desc = resources[pass.writes.front()].desc;
+        viewport = glm::ivec4(0, 0, desc.width, desc.height);
+    }
+    glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+    pass_viewport = viewport;
+
+    if (pass.clear_mask != 0) {
+        if (pass.has_viewport) {
+            glScissor(viewport.x, viewport.y, viewport.z, viewport.w);
+            glEnable(GL_SCISSOR_TEST);
+        }
+
+        if (pass.clear_mask & GL_DEPTH_BUFFER_BIT) {
+            glDepthMask(GL_TRUE);
+        }
+        glClearColor(pass.clear_color.x, pass.clear_color.y, pass.clear_color.z, pass.clear_color.w);
+        glClear(pass.clear_mask);
+
+        glDisable(GL_SCISSOR_TEST);
+    }
+}
+
+void FrameGraph::blit(Resource source, GLenum filter) const {
+    const auto& node = resources[source];
+    const auto& desc = node.desc;
+
+    const GLenum attachment = desc.is_depth() ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0;
+    const GLbitfield mask = desc.is_depth() ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, blit_framebuffer);
+    glFramebufferTexture(GL_READ_FRAMEBUFFER, attachment, node.texture, 0);
+    glReadBuffer(desc.is_depth() ? GL_NONE : GL_COLOR_ATTACHMENT0);
+
+    glBlitFramebuffer(0, 0, desc.width, desc.height,
+                      pass_viewport.x, pass_viewport.y, pass_viewport.x + pass_viewport.z, pass_viewport.y + pass_viewport.w,
+                      mask, desc.is_depth() ? GL_NEAREST : filter);
+
+    glFramebufferTexture(GL_READ_FRAMEBUFFER, attachment, 0, 0);
+
+    // Restore the framebuffer of the pass for reading as well
+    GLint framebuffer;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(framebuffer));
+    GL_CHECK_ERRORS;
+}
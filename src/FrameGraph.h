@@ -0,0 +1,179 @@
+#ifndef SPACEOBJECTS_FRAMEGRAPH_H
+#define SPACEOBJECTS_FRAMEGRAPH_H
+
+#include <array>
+#include <functional>
+#include <map>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "FrameArena.h"
+
+struct TextureDesc {
+    GLsizei width = 0;
+    GLsizei height = 0;
+    GLenum format = GL_RGBA8;  // Internal format
+    GLsizei samples = 0;       // 0 - regular texture, otherwise multisampled
+
+    TextureDesc() = default;
+
+    TextureDesc(GLsizei width, GLsizei height, GLenum format, GLsizei samples = 0) :
+        width(width), height(height), format(format), samples(samples) {}
+
+    bool is_depth() const {
+        return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24
+            || format == GL_DEPTH_COMPONENT32 || format == GL_DEPTH_COMPONENT32F
+            || format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+    }
+
+    friend bool operator==(const TextureDesc& first, const TextureDesc& second) {
+        return first.width == second.width && first.height == second.height
+            && first.format == second.format && first.samples == second.samples;
+    }
+};
+
+// Schedules the render passes of a frame.
+// Passes are declared every frame together with the resources they read and write.
+// On compile passes whose results never reach an imported resource (the backbuffer)
+// are culled, and lifetimes of transient textures are computed, so that textures
+// which are never alive at the same time share the same GL storage.
+// Framebuffers, viewports and clears of the passes are handled by the graph as well.
+class FrameGraph {
+public:
+    typedef int Resource;
+
+    static constexpr int max_color_attachments = 4;
+
+    class Builder {
+        FrameGraph& graph;
+        int pass;
+
+    public:
+        Builder(FrameGraph& graph, int pass) : graph(graph), pass(pass) {}
+
+        // Transient texture, alive only between its first and last use in the frame
+        Resource create(const char* name, const TextureDesc& desc);
+
+        Resource read(Resource resource);
+
+        Resource write(Resource resource);
+
+        void clear(GLbitfield mask, const glm::vec4& color = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+        // Render into a part of the target only, clears are limited to it as well
+        void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+        // Never cull the pass, even if nothing reads its output
+        void side_effect();
+    };
+
+    struct Stats {
+        int passes = 0;
+        int culled = 0;
+        int transient = 0;   // Transient resources used during the frame
+        int physical = 0;    // GL textures backing them
+    };
+
+private:
+    struct ResourceNode {
+        const char* name;
+        TextureDesc desc;
+        bool imported;
+        GLuint texture;      // 0 for the backbuffer
+        int ref_count;
+        int first_use;
+        int last_use;
+        FrameVector<int> writers;
+    };
+
+    struct PassNode {
+        const char* name;
+        FrameVector<Resource> reads;
+        FrameVector<Resource> writes;
+        std::function<void(const FrameGraph&)> execute;
+        GLbitfield clear_mask;
+        glm::vec4 clear_color;
+        bool has_viewport;
+        glm::ivec4 viewport;
+        bool side_effect;
+        int ref_count;
+    };
+
+    struct PooledTexture {
+        TextureDesc desc;
+        GLuint texture;
+        bool in_use;
+        unsigned last_frame;
+    };
+
+    typedef std::array<GLuint, max_color_attachments + 1> AttachmentKey;  // Colors and depth
+
+    std::vector<ResourceNode> resources;
+    std::vector<PassNode> passes;
+    std::vector<int> order;
+
+    FrameArena* arena = nullptr;  // Of the frame being declared, holds the lists of the nodes
+
+    std::vector<PooledTexture> pool;
+    std::map<AttachmentKey, GLuint> framebuffers;
+    unsigned frame = 0;
+
+    GLuint blit_framebuffer = 0;  // Read side of blits
+    glm::ivec4 pass_viewport;
+
+    Stats stats;
+
+    GLuint acquire(const TextureDesc& desc);
+
+    void release(GLuint texture);
+
+    void evict_unused();
+
+    GLuint get_framebuffer(const PassNode& pass);
+
+    void begin_pass(const PassNode& pass);
+
+public:
+    // Textures unused for this many frames are deleted
+    unsigned max_unused_frames = 60;
+
+    FrameGraph() = default;
+
+    // Start declaring a new frame, its passes and resources are kept in the arena until the next reset.
+    // Physical textures and framebuffers are kept
+    void reset(FrameArena& arena);
+
+    Resource import_texture(const char* name, GLuint texture, const TextureDesc& desc);
+
+    Resource import_backbuffer(const char* name, GLsizei width, GLsizei height);
+
+    // The setup callback is invoked immediately to declare the resources of the pass
+    void add_pass(const char* name,
+                  const std::function<void(Builder&)>& setup,
+                  const std::function<void(const FrameGraph&)>& execute);
+
+    void compile();
+
+    void execute();
+
+    // Physical texture of a resource, valid inside execute callbacks
+    GLuint get_texture(Resource resource) const {
+        return resources[resource].texture;
+    }
+
+    const TextureDesc& get_desc(Resource resource) const {
+        return resources[resource].desc;
+    }
+
+    // Copy a texture into the targets of the running pass, stretched over its viewport.
+    // Multisampled sources are resolved, which requires the sizes to match
+    void blit(Resource source, GLenum filter = GL_LINEAR) const;
+
+    const Stats& get_stats() const {
+        return stats;
+    }
+};
+
+#endif //SPACEOBJECTS_FRAMEGRAPH_H
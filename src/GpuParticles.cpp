@@ -0,0 +1,92 @@
+#include "GpuParticles.h"
+
+#include <cmath>
+#include <cstddef>
+#include <glm/gtc/type_ptr.hpp>
+
+GpuParticles::GpuParticles(GLsizei count) : count(count) {
+    // Particles start unborn with staggered negative ages, so the emission is spread evenly over the first second
+    std::vector<State> initial(count);
+    for (GLsizei i = 0; i < count; i++) {
+        auto& state = initial[i];
+        for (int k = 0; k < 3; k++) {
+            state.position[k] = 0.0f;
+            state.velocity[k] = 0.0f;
+        }
+        state.age[0] = -float(i) / count;
+        state.age[1] = 0.0f;
+        for (int k = 0; k < 4; k++) {
+            state.color[k] = 0.0f;
+        }
+    }
+
+    glGenVertexArrays(2, VAO);
+    glGenBuffers(2, VBO);
+
+    for (int i = 0; i < 2; i++) {
+        glBindVertexArray(VAO[i]);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO[i]);
+        glBufferData(GL_ARRAY_BUFFER, count * sizeof(State), initial.data(), GL_DYNAMIC_COPY);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(State), (void*) offsetof(State, position));
+
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(State), (void*) offsetof(State, velocity));
+
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(State), (void*) offsetof(State, age));
+
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(State), (void*) offsetof(State, color));
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GL_CHECK_ERRORS;
+}
+
+const std::vector<std::string>& GpuParticles::feedback_varyings() {
+    static const std::vector<std::string> varyings = {
+        "out_position",
+        "out_velocity",
+        "out_age",
+        "out_color",
+    };
+    return varyings;
+}
+
+void GpuParticles::update(const ShaderProgram& program, float dt) {
+    const int next = 1 - current;
+
+    program.StartUseShader();
+
+    program.SetUniform("dt", dt);
+    program.SetUniform("seed", seed++);
+    program.SetUniform("damping", std::pow(emitter.damping, dt));
+    program.SetUniform("emitter_position", emitter.position);
+    program.SetUniform("emitter_direction", glm::normalize(emitter.direction));
+    program.SetUniform("emitter_spread", emitter.spread);
+    program.SetUniform("emitter_speed", emitter.speed);
+    program.SetUniform("emitter_lifetime", emitter.lifetime);
+    program.SetUniform("emitter_color", emitter.color);
+
+    // Nothing is rasterized, the vertex stage output goes straight into the other buffer
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, VBO[next]);
+    glBindVertexArray(VAO[current]);
+
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, count);
+    glEndTransformFeedback();
+
+    glBindVertexArray(0);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+    GL_CHECK_ERRORS;
+
+    program.StopUseShader();
+
+    current = next;
+}
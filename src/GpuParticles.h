@@ -0,0 +1,65 @@
+#ifndef SPACEOBJECTS_GPUPARTICLES_H
+#define SPACEOBJECTS_GPUPARTICLES_H
+
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "ShaderProgram.h"
+
+// Particle system simulated entirely on the GPU.
+// Particle state lives in two vertex buffers which are ping-ponged every update:
+// the update program reads one of them and writes the other one through transform feedback.
+// After the initial upload the CPU only sets emitter uniforms.
+// Uses nothing beyond core OpenGL 3.3, so it runs on software drivers (e.g. Mesa llvmpipe) as well.
+class GpuParticles {
+    struct State {
+        GLfloat position[3];
+        GLfloat velocity[3];
+        GLfloat age[2];       // Current age and lifetime in seconds
+        GLfloat color[4];
+    };
+
+    GLuint VAO[2] = {0, 0};
+    GLuint VBO[2] = {0, 0};
+    int current = 0;  // Buffer holding the latest state
+
+    GLsizei count = 0;
+    GLuint seed = 0;
+
+public:
+    struct Emitter {
+        glm::vec3 position = glm::vec3(0.0f);
+        glm::vec3 direction = glm::vec3(0.0f, 0.0f, 1.0f);
+        float spread = 0.3f;      // 0 - straight beam, 1 - full sphere
+        float speed = 4.0f;
+        float lifetime = 1.0f;
+        float damping = 0.5f;     // Velocity multiplier per second
+        glm::vec4 color = glm::vec4(0.4f, 0.6f, 1.0f, 1.0f);
+    };
+
+    Emitter emitter;
+
+    GpuParticles() = default;
+
+    explicit GpuParticles(GLsizei count);
+
+    // Names of the update program outputs, in the order of the State layout
+    static const std::vector<std::string>& feedback_varyings();
+
+    // Advance the simulation. The program must be linked with feedback_varyings()
+    void update(const ShaderProgram& program, float dt);
+
+    void draw() const {
+        glBindVertexArray(VAO[current]);
+
+        glDrawArrays(GL_POINTS, 0, count);
+        GL_CHECK_ERRORS;
+
+        glBindVertexArray(0);
+    }
+};
+
+#endif //SPACEOBJECTS_GPUPARTICLES_H
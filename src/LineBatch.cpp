@@ -0,0 +1,114 @@
+#include "LineBatch.h"
+
+#include <cstring>
+#include <cstddef>
+
+void LineBatch::init(GLsizeiptr capacity) {
+    this->capacity = capacity;
+    head = 0;
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, position));
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*) offsetof(Vertex, color));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    lines.reserve(1024);
+    points.reserve(1024);
+}
+
+void LineBatch::box(const BBox& bbox, const glm::mat4& transform, const glm::vec4& color) {
+    glm::vec3 corners[8];
+    for (int i = 0; i < 8; i++) {
+        const glm::vec3 corner(
+            (i & 1) ? bbox.max.x : bbox.min.x,
+            (i & 2) ? bbox.max.y : bbox.min.y,
+            (i & 4) ? bbox.max.z : bbox.min.z
+        );
+        corners[i] = glm::vec3(transform * glm::vec4(corner, 1.0f));
+    }
+
+    // Every edge connects corners which differ in exactly one bit
+    for (int i = 0; i < 8; i++) {
+        for (int bit = 1; bit < 8; bit <<= 1) {
+            if ((i & bit) == 0) {
+                line(corners[i], corners[i | bit], color);
+            }
+        }
+    }
+}
+
+GLint LineBatch::upload() {
+    const auto total = GLsizeiptr(lines.size() + points.size());
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+
+    if (total > capacity) {
+        // Grow the ring, previous storage gets orphaned by the driver
+        while (capacity < total) {
+            capacity *= 2;
+        }
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+        head = 0;
+    } else if (head + total > capacity) {
+        // Wrap around: orphan the storage so the GPU may still read the old one
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Vertex), nullptr, GL_STREAM_DRAW);
+        head = 0;
+    }
+
+    const auto first = head;
+    auto dst = static_cast<Vertex*>(glMapBufferRange(
+        GL_ARRAY_BUFFER,
+        first * sizeof(Vertex),
+        total * sizeof(Vertex),
+        GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT
+    ));
+    GL_CHECK_ERRORS;
+
+    if (dst != nullptr) {
+        std::memcpy(dst, lines.data(), lines.size() * sizeof(Vertex));
+        std::memcpy(dst + lines.size(), points.data(), points.size() * sizeof(Vertex));
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    head += total;
+    return GLint(first);
+}
+
+void LineBatch::flush() {
+    if (empty()) {
+        return;
+    }
+
+    const auto first = upload();
+
+    glBindVertexArray(VAO);
+
+    if (!lines.empty()) {
+        glDrawArrays(GL_LINES, first, GLsizei(lines.size()));
+        GL_CHECK_ERRORS;
+    }
+
+    if (!points.empty()) {
+        glDrawArrays(GL_POINTS, first + GLint(lines.size()), GLsizei(points.size()));
+        GL_CHECK_ERRORS;
+    }
+
+    glBindVertexArray(0);
+
+    lines.clear();
+    points.clear();
+}
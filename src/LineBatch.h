@@ -0,0 +1,63 @@
+#ifndef SPACEOBJECTS_LINEBATCH_H
+#define SPACEOBJECTS_LINEBATCH_H
+
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "BBox.h"
+
+// Collects lines and points of a whole frame (lasers, bbox wireframes, debug geometry)
+// and submits them with a single draw call per primitive type.
+// Vertices are streamed into a ring buffer: every flush is written behind the previous one
+// with an unsynchronized mapping, the buffer storage is orphaned only when the ring wraps.
+class LineBatch {
+public:
+    struct Vertex {
+        glm::vec3 position;
+        glm::vec4 color;
+    };
+
+private:
+    GLuint VAO = 0, VBO = 0;
+    GLsizeiptr capacity = 0;  // In vertices
+    GLsizeiptr head = 0;
+
+    std::vector<Vertex> lines;
+    std::vector<Vertex> points;
+
+    GLint upload();
+
+public:
+    LineBatch() = default;
+
+    void init(GLsizeiptr capacity = 1 << 16);
+
+    void line(const glm::vec3& src, const glm::vec3& dst, const glm::vec4& color) {
+        lines.push_back({src, color});
+        lines.push_back({dst, color});
+    }
+
+    void point(const glm::vec3& position, const glm::vec4& color) {
+        points.push_back({position, color});
+    }
+
+    // Wireframe of an axis aligned box
+    void box(const BBox& bbox, const glm::vec4& color) {
+        box(bbox, glm::mat4(1.0f), color);
+    }
+
+    // Wireframe of a box given in local space of the transform
+    void box(const BBox& bbox, const glm::mat4& transform, const glm::vec4& color);
+
+    bool empty() const {
+        return lines.empty() && points.empty();
+    }
+
+    // Upload everything collected since the last flush and draw it.
+    // The caller is responsible for the active shader program.
+    void flush();
+};
+
+#endif //SPACEOBJECTS_LINEBATCH_H
@@ -9,6 +9,7 @@ public:
     GLuint diffuse_texture;
     glm::vec4 diffuse_color;
     float opacity;
+    bool alpha_test = false;  // Diffuse texture has cut out parts in its alpha channel
 
     explicit Material(GLuint diffuse_texture, const glm::vec4& diffuse_color = glm::vec4(1.0f), float opacity=1.0) :
         diffuse_texture(diffuse_texture),
@@ -0,0 +1,483 @@
+#include "MeshBvh.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <istream>
+#include <limits>
+#include <ostream>
+
+static_assert(sizeof(MeshBvh::Node) == 32, "Nodes are meant to fit two per cache line");
+
+namespace {
+
+struct Bounds {
+    glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+    glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+    void grow(const glm::vec3& point_min, const glm::vec3& point_max) {
+        min = glm::min(min, point_min);
+        max = glm::max(max, point_max);
+    }
+
+    void grow(const Bounds& other) {
+        grow(other.min, other.max);
+    }
+
+    float half_area() const {
+        const auto extent = glm::max(max - min, glm::vec3(0.0f));
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+};
+
+struct Bin {
+    Bounds bounds;
+    uint32_t count = 0;
+};
+
+typedef std::array<std::array<Bin, MeshBvh::bin_count>, 3> Bins;
+
+struct Split {
+    int axis = -1;  // None found
+    int plane = 0;  // Bins up to this one go to the first child
+    float cost = std::numeric_limits<float>::max();
+};
+
+// Input of the build: bounds and centroids of the triangles, and their order which the splits partition
+struct BuildState {
+    std::vector<glm::vec3> min;
+    std::vector<glm::vec3> max;
+    std::vector<glm::vec3> centroids;
+    std::vector<uint32_t> order;
+    std::vector<uint32_t> scratch;  // Target of the parallel partition
+    WorkerPool* workers;
+};
+
+// Node of the top levels, split by all workers together before the subtrees are built one per worker
+struct TopNode {
+    Bounds bounds;
+    uint32_t begin, end;
+    int depth;
+    int children[2];  // Into the top nodes, -1 for subtree roots
+    size_t subtree;   // Into the subtrees
+};
+
+}
+
+// Run `task` over [0, count) on the workers, or inline without them
+static void parallel_for(WorkerPool* workers, size_t count, size_t grain, const WorkerPool::Task& task) {
+    if (workers != nullptr) {
+        workers->parallel_for(count, grain, task);
+    } else {
+        task(0, count, 0);
+    }
+}
+
+// Bounds of the triangles and of their centroids over order[begin, end)
+static void measure(const BuildState& state, uint32_t begin, uint32_t end, Bounds& bounds, Bounds& centroid_bounds) {
+    for (uint32_t i = begin; i < end; i++) {
+        const auto triangle = state.order[i];
+        bounds.grow(state.min[triangle], state.max[triangle]);
+        centroid_bounds.grow(state.centroids[triangle], state.centroids[triangle]);
+    }
+}
+
+static int bin_of(const glm::vec3& centroid, int axis, const Bounds& centroid_bounds) {
+    const float extent = centroid_bounds.max[axis] - centroid_bounds.min[axis];
+    const int bin = int((centroid[axis] - centroid_bounds.min[axis]) * (MeshBvh::bin_count / extent));
+    return std::min(bin, MeshBvh::bin_count - 1);
+}
+
+// Bin the centroids of order[begin, end) along every axis they spread over
+static void fill_bins(const BuildState& state, uint32_t begin, uint32_t end, const Bounds& centroid_bounds, Bins& bins) {
+    for (int axis = 0; axis < 3; axis++) {
+        if (centroid_bounds.max[axis] <= centroid_bounds.min[axis]) continue;
+
+        for (uint32_t i = begin; i < end; i++) {
+            const auto triangle = state.order[i];
+            auto& bin = bins[axis][bin_of(state.centroids[triangle], axis, centroid_bounds)];
+            bin.bounds.grow(state.min[triangle], state.max[triangle]);
+            bin.count++;
+        }
+    }
+}
+
+// Cheapest plane between bins. The cost counts triangle tests weighted by the probability of entering the child
+static Split find_split(const Bins& bins, uint32_t count) {
+    Split split;
+    for (int axis = 0; axis < 3; axis++) {
+        // Costs of the first sides sweeping forward, the second sides are added sweeping back
+        float first_cost[MeshBvh::bin_count - 1];
+        Bin first;
+        for (int plane = 0; plane < MeshBvh::bin_count - 1; plane++) {
+            first.bounds.grow(bins[axis][plane].bounds);
+            first.count += bins[axis][plane].count;
+            first_cost[plane] = first.count > 0 ? first.bounds.half_area() * float(first.count) : 0.0f;
+        }
+
+        Bin second;
+        for (int plane = MeshBvh::bin_count - 2; plane >= 0; plane--) {
+            second.bounds.grow(bins[axis][plane + 1].bounds);
+            second.count += bins[axis][plane + 1].count;
+            if (second.count == 0 || second.count == count) continue;
+
+            const float cost = first_cost[plane] + second.bounds.half_area() * float(second.count);
+            if (cost < split.cost) {
+                split.axis = axis;
+                split.plane = plane;
+                split.cost = cost;
+            }
+        }
+    }
+    return split;
+}
+
+// Splitting pays off when the expected triangle tests plus one more box test are fewer than testing all of them
+static bool worth_splitting(const Split& split, const Bounds& bounds, uint32_t count, int depth) {
+    if (split.axis < 0 || count <= 2 || depth >= MeshBvh::max_depth) {
+        return false;
+    }
+    return count > MeshBvh::max_leaf_size || 1.0f + split.cost / bounds.half_area() < float(count);
+}
+
+// Builds the subtree over order[begin, end) depth first on the calling thread and returns the index of its root
+static uint32_t build_node(BuildState& state, std::vector<MeshBvh::Node>& nodes, uint32_t begin, uint32_t end, int depth) {
+    const auto index = uint32_t(nodes.size());
+    nodes.push_back({});
+
+    Bounds bounds, centroid_bounds;
+    measure(state, begin, end, bounds, centroid_bounds);
+    nodes[index].min = bounds.min;
+    nodes[index].max = bounds.max;
+
+    const uint32_t count = end - begin;
+    Split split;
+    if (count > 2 && depth < MeshBvh::max_depth) {
+        Bins bins;
+        fill_bins(state, begin, end, centroid_bounds, bins);
+        split = find_split(bins, count);
+    }
+
+    if (!worth_splitting(split, bounds, count, depth)) {
+        nodes[index].offset = begin;
+        nodes[index].count = count;
+        return index;
+    }
+
+    const auto middle = std::partition(state.order.begin() + begin, state.order.begin() + end, [&](uint32_t triangle) {
+        return bin_of(state.centroids[triangle], split.axis, centroid_bounds) <= split.plane;
+    });
+
+    build_node(state, nodes, begin, uint32_t(middle - state.order.begin()), depth + 1);
+    nodes[index].offset = build_node(state, nodes, uint32_t(middle - state.order.begin()), end, depth + 1);
+    nodes[index].count = 0;
+    return index;
+}
+
+// Split a top node with all workers: bounds and bins per chunk are merged, then the chunks
+// are partitioned into the scratch array at offsets from the prefix sums of their counts.
+// Returns the first triangle of the second child, or `end` if the node is not worth splitting
+static uint32_t split_parallel(BuildState& state, TopNode& node) {
+    const int worker_count = state.workers->size();
+    const uint32_t count = node.end - node.begin;
+    const size_t chunk_count = 4 * size_t(worker_count);
+    const uint32_t chunk = uint32_t((count + chunk_count - 1) / chunk_count);
+
+    auto chunk_begin = [&](size_t i) {
+        return std::min(node.begin + uint32_t(i) * chunk, node.end);
+    };
+
+    std::vector<Bounds> bounds(worker_count), centroid_bounds(worker_count);
+    parallel_for(state.workers, chunk_count, 1, [&](size_t begin, size_t end, int worker) {
+        for (size_t i = begin; i < end; i++) {
+            measure(state, chunk_begin(i), chunk_begin(i + 1), bounds[worker], centroid_bounds[worker]);
+        }
+    });
+    for (int i = 1; i < worker_count; i++) {
+        bounds[0].grow(bounds[i]);
+        centroid_bounds[0].grow(centroid_bounds[i]);
+    }
+    node.bounds = bounds[0];
+
+    std::vector<Bins> bins(worker_count);
+    parallel_for(state.workers, chunk_count, 1, [&](size_t begin, size_t end, int worker) {
+        for (size_t i = begin; i < end; i++) {
+            fill_bins(state, chunk_begin(i), chunk_begin(i + 1), centroid_bounds[0], bins[worker]);
+        }
+    });
+    for (int i = 1; i < worker_count; i++) {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int bin = 0; bin < MeshBvh::bin_count; bin++) {
+                bins[0][axis][bin].bounds.grow(bins[i][axis][bin].bounds);
+                bins[0][axis][bin].count += bins[i][axis][bin].count;
+            }
+        }
+    }
+
+    const auto split = find_split(bins[0], count);
+    if (!worth_splitting(split, node.bounds, count, node.depth)) {
+        return node.end;
+    }
+
+    auto goes_first = [&](uint32_t triangle) {
+        return bin_of(state.centroids[triangle], split.axis, centroid_bounds[0]) <= split.plane;
+    };
+
+    std::vector<uint32_t> firsts(chunk_count + 1, 0);
+    parallel_for(state.workers, chunk_count, 1, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            firsts[i + 1] = uint32_t(std::count_if(state.order.begin() + chunk_begin(i), state.order.begin() + chunk_begin(i + 1), goes_first));
+        }
+    });
+    for (size_t i = 0; i < chunk_count; i++) {
+        firsts[i + 1] += firsts[i];
+    }
+    const uint32_t middle = node.begin + firsts[chunk_count];
+
+    parallel_for(state.workers, chunk_count, 1, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t first = node.begin + firsts[i];
+            uint32_t second = middle + (chunk_begin(i) - node.begin - firsts[i]);
+            for (uint32_t j = chunk_begin(i); j < chunk_begin(i + 1); j++) {
+                const auto triangle = state.order[j];
+                state.scratch[goes_first(triangle) ? first++ : second++] = triangle;
+            }
+        }
+    });
+    std::copy(state.scratch.begin() + node.begin, state.scratch.begin() + node.end, state.order.begin() + node.begin);
+
+    return middle;
+}
+
+// Append the nodes under a top node depth first, with the subtrees linked in, and return its index
+static uint32_t emit(const std::vector<TopNode>& top, int index, std::vector<std::vector<MeshBvh::Node>>& subtrees,
+                     std::vector<MeshBvh::Node>& nodes) {
+    const auto& node = top[index];
+    const auto root = uint32_t(nodes.size());
+
+    if (node.children[0] < 0) {
+        // Links between the nodes of a subtree move with its base, triangle offsets stay
+        for (auto subtree_node : subtrees[node.subtree]) {
+            if (subtree_node.count == 0) {
+                subtree_node.offset += root;
+            }
+            nodes.push_back(subtree_node);
+        }
+        return root;
+    }
+
+    nodes.push_back({node.bounds.min, 0, node.bounds.max, 0});
+    emit(top, node.children[0], subtrees, nodes);
+    nodes[root].offset = emit(top, node.children[1], subtrees, nodes);
+    return root;
+}
+
+std::shared_ptr<const MeshBvh> MeshBvh::build(const std::vector<float>& vertices, const std::vector<uint32_t>& elements,
+                                              WorkerPool* workers) {
+    auto bvh = std::make_shared<MeshBvh>();
+    const size_t count = elements.size() / 3;
+    if (count == 0) {
+        return bvh;
+    }
+
+    auto vertex = [&](uint32_t element) {
+        return glm::vec3(vertices[3 * element], vertices[3 * element + 1], vertices[3 * element + 2]);
+    };
+
+    BuildState state;
+    state.min.resize(count);
+    state.max.resize(count);
+    state.centroids.resize(count);
+    state.order.resize(count);
+    state.workers = workers;
+
+    parallel_for(workers, count, 4096, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            const auto a = vertex(elements[3 * i]);
+            const auto b = vertex(elements[3 * i + 1]);
+            const auto c = vertex(elements[3 * i + 2]);
+            state.min[i] = glm::min(a, glm::min(b, c));
+            state.max[i] = glm::max(a, glm::max(b, c));
+            state.centroids[i] = 0.5f * (state.min[i] + state.max[i]);
+            state.order[i] = uint32_t(i);
+        }
+    });
+
+    // The top levels are split by all workers together until there are enough subtrees
+    // to keep every worker busy, then the subtrees are built one per worker
+    const int worker_count = workers != nullptr ? workers->size() : 1;
+    const size_t subtree_size = worker_count > 1 ? std::max<size_t>(count / (8 * size_t(worker_count)), 1024) : count;
+
+    std::vector<TopNode> top;
+    std::vector<int> subtree_roots;
+    top.push_back({Bounds(), 0, uint32_t(count), 0, {-1, -1}, 0});
+    if (count > subtree_size) {
+        state.scratch.resize(count);
+    }
+
+    for (size_t i = 0; i < top.size(); i++) {
+        const uint32_t middle = top[i].end - top[i].begin > subtree_size ? split_parallel(state, top[i]) : top[i].end;
+        if (middle == top[i].end) {
+            top[i].subtree = subtree_roots.size();
+            subtree_roots.push_back(int(i));
+            continue;
+        }
+
+        const TopNode first = {Bounds(), top[i].begin, middle, top[i].depth + 1, {-1, -1}, 0};
+        const TopNode second = {Bounds(), middle, top[i].end, top[i].depth + 1, {-1, -1}, 0};
+        top[i].children[0] = int(top.size());
+        top[i].children[1] = int(top.size()) + 1;
+        top.push_back(first);
+        top.push_back(second);
+    }
+
+    std::vector<std::vector<Node>> subtrees(subtree_roots.size());
+    parallel_for(workers, subtree_roots.size(), 1, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            const auto& root = top[subtree_roots[i]];
+            // A binary tree with leaves of one triangle or more has fewer than twice as many nodes
+            subtrees[i].reserve(2 * (root.end - root.begin));
+            build_node(state, subtrees[i], root.begin, root.end, root.depth);
+        }
+    });
+
+    bvh->nodes.reserve(2 * count);
+    emit(top, 0, subtrees, bvh->nodes);
+
+    bvh->triangles.resize(count);
+    parallel_for(workers, count, 4096, [&](size_t begin, size_t end, int) {
+        for (size_t i = begin; i < end; i++) {
+            const auto triangle = state.order[i];
+            const auto a = vertex(elements[3 * triangle]);
+            bvh->triangles[i] = {a, vertex(elements[3 * triangle + 1]) - a, vertex(elements[3 * triangle + 2]) - a};
+        }
+    });
+    return bvh;
+}
+
+// Entry distance of the ray into the box, or infinity if it misses the box or enters it beyond `distance`
+static float enter_box(const MeshBvh::Node& node, const glm::vec3& origin, const glm::vec3& direction_inverse,
+                       float distance) {
+    const auto t0 = (node.min - origin) * direction_inverse;
+    const auto t1 = (node.max - origin) * direction_inverse;
+    const auto near_planes = glm::min(t0, t1);
+    const auto far_planes = glm::max(t0, t1);
+
+    const float near = std::max(std::max(near_planes.x, std::max(near_planes.y, near_planes.z)), 0.0f);
+    const float far = std::min(far_planes.x, std::min(far_planes.y, far_planes.z));
+    return near <= far && near <= distance ? near : std::numeric_limits<float>::infinity();
+}
+
+bool MeshBvh::intersect(const glm::vec3& origin, const glm::vec3& direction, float& distance) const {
+    if (nodes.empty()) {
+        return false;
+    }
+
+    const auto direction_inverse = 1.0f / direction;
+    bool hit = false;
+
+    uint32_t stack[max_depth];
+    int stack_size = 0;
+
+    if (enter_box(nodes[0], origin, direction_inverse, distance) == std::numeric_limits<float>::infinity()) {
+        return false;
+    }
+    uint32_t current = 0;
+
+    while (true) {
+        const auto& node = nodes[current];
+        if (node.count > 0) {
+            // Möller-Trumbore
+            for (uint32_t i = node.offset; i < node.offset + node.count; i++) {
+                const auto& triangle = triangles[i];
+                const auto p = glm::cross(direction, triangle.edge2);
+                const float determinant = glm::dot(triangle.edge1, p);
+                if (std::abs(determinant) < 1e-12f) continue;
+
+                const float inverse = 1.0f / determinant;
+                const auto s = origin - triangle.vertex;
+                const float u = glm::dot(s, p) * inverse;
+                if (u < 0.0f || u > 1.0f) continue;
+
+                const auto q = glm::cross(s, triangle.edge1);
+                const float v = glm::dot(direction, q) * inverse;
+                if (v < 0.0f || u + v > 1.0f) continue;
+
+                const float t = glm::dot(triangle.edge2, q) * inverse;
+                if (t >= 0.0f && t < distance) {
+                    distance = t;
+                    hit = true;
+                }
+            }
+        } else {
+            // Visit the nearer child first, the farther one is often culled by the hit found in the nearer
+            uint32_t first = current + 1, second = node.offset;
+            float first_distance = enter_box(nodes[first], origin, direction_inverse, distance);
+            float second_distance = enter_box(nodes[second], origin, direction_inverse, distance);
+            if (second_distance < first_distance) {
+                std::swap(first, second);
+                std::swap(first_distance, second_distance);
+            }
+
+            if (first_distance != std::numeric_limits<float>::infinity()) {
+                if (second_distance != std::numeric_limits<float>::infinity()) {
+                    stack[stack_size++] = second;
+                }
+                current = first;
+                continue;
+            }
+        }
+
+        // Boxes on the stack may have been passed by a closer hit in the meantime
+        bool found = false;
+        while (stack_size > 0 && !found) {
+            current = stack[--stack_size];
+            found = enter_box(nodes[current], origin, direction_inverse, distance) != std::numeric_limits<float>::infinity();
+        }
+        if (!found) {
+            return hit;
+        }
+    }
+}
+
+void MeshBvh::write(std::ostream& stream) const {
+    const uint32_t sizes[2] = {uint32_t(nodes.size()), uint32_t(triangles.size())};
+    stream.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    stream.write(reinterpret_cast<const char*>(nodes.data()), std::streamsize(nodes.size() * sizeof(Node)));
+    stream.write(reinterpret_cast<const char*>(triangles.data()), std::streamsize(triangles.size() * sizeof(Triangle)));
+}
+
+std::shared_ptr<const MeshBvh> MeshBvh::read(std::istream& stream) {
+    uint32_t sizes[2];
+    if (!stream.read(reinterpret_cast<char*>(sizes), sizeof(sizes))) {
+        return nullptr;
+    }
+
+    auto bvh = std::make_shared<MeshBvh>();
+    bvh->nodes.resize(sizes[0]);
+    bvh->triangles.resize(sizes[1]);
+    stream.read(reinterpret_cast<char*>(bvh->nodes.data()), std::streamsize(bvh->nodes.size() * sizeof(Node)));
+    stream.read(reinterpret_cast<char*>(bvh->triangles.data()), std::streamsize(bvh->triangles.size() * sizeof(Triangle)));
+    if (!stream) {
+        return nullptr;
+    }
+
+    // A damaged file must not send the traversal out of the arrays or beyond the depth of its stack.
+    // Children come after their parent, so depths are known by the time a node is visited
+    std::vector<uint8_t> depths(bvh->nodes.size(), 0);
+    for (size_t i = 0; i < bvh->nodes.size(); i++) {
+        const auto& node = bvh->nodes[i];
+        if (node.count > 0) {
+            if (uint64_t(node.offset) + node.count > bvh->triangles.size()) {
+                return nullptr;
+            }
+            continue;
+        }
+
+        if (node.offset <= i + 1 || node.offset >= bvh->nodes.size() || depths[i] >= max_depth) {
+            return nullptr;
+        }
+        depths[i + 1] = depths[node.offset] = uint8_t(depths[i] + 1);
+    }
+    return bvh;
+}
@@ -0,0 +1,54 @@
+#ifndef SPACEOBJECTS_MESHBVH_H
+#define SPACEOBJECTS_MESHBVH_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "WorkerPool.h"
+
+// Bounding volume hierarchy over the triangles of one mesh, for exact ray hits.
+// Built with binned surface area heuristic splits, in parallel when given workers. Nodes are stored depth first in
+// 32 bytes: the first child directly follows its parent, so only the second one is linked.
+// Triangles are reordered to the leaves and keep what the ray test needs precomputed
+struct MeshBvh {
+    struct Node {
+        glm::vec3 min;
+        uint32_t offset;  // Leaves: first triangle, interior nodes: second child
+        glm::vec3 max;
+        uint32_t count;   // Triangles of a leaf, 0 for interior nodes
+    };
+
+    struct Triangle {
+        glm::vec3 vertex;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+    };
+
+    static constexpr uint32_t max_leaf_size = 8;
+    static constexpr int bin_count = 16;
+    static constexpr int max_depth = 48;  // Deeper nodes become leaves, it bounds the traversal stack
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+
+    // Vertices are packed xyz, every three elements make a triangle.
+    // The top levels are split by all workers together, the subtrees below are built one per worker
+    static std::shared_ptr<const MeshBvh> build(const std::vector<float>& vertices, const std::vector<uint32_t>& elements,
+                                                WorkerPool* workers = nullptr);
+
+    // Raw nodes and triangles in the byte order of the machine
+    void write(std::ostream& stream) const;
+
+    // Null if the stream ends early or holds links out of range
+    static std::shared_ptr<const MeshBvh> read(std::istream& stream);
+
+    // Closest triangle along the ray within `distance`, which is lowered to the hit.
+    // The direction doesn't need to be normalized, distances are measured in its lengths.
+    // Triangles are hit from both sides
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float& distance) const;
+};
+
+#endif //SPACEOBJECTS_MESHBVH_H
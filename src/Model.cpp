@@ -3,13 +3,12 @@
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
+#include <algorithm>
+#include <fstream>
 #include <iostream>
 #include <il.h>
 
-Model::Model(const std::string& path) :
-    world_pos(0.0f, 0.0f, 0.0f),
-    rot(1.0f) {
-
+Model::Model(const std::string& path) {
     model_location = path.substr(0, path.find_last_of('/'));
 
     Assimp::Importer importer;
@@ -20,14 +19,14 @@ Model::Model(const std::string& path) :
     } else {
         process_textures(scene);
 
-        process_object(scene->mRootNode, scene);
+        process_object(scene->mRootNode, scene, glm::mat4(1.0f));
     }
 
     // Calculate bbox
     for (const auto& object : objects) {
         for (int i = 0; i < object.vertices.size(); i += 3) {
             const auto v = object.vertices.data() + i;
-            const glm::vec3 vertex(v[0], v[1], v[2]);
+            const glm::vec3 vertex = object.getModelTransform() * glm::vec4(v[0], v[1], v[2], 1.0f);
 
             bbox.min = glm::min(bbox.min, vertex);
             bbox.max = glm::max(bbox.max, vertex);
@@ -35,19 +34,111 @@ Model::Model(const std::string& path) :
     }
 }
 
-void Model::process_object(const aiNode* node, const aiScene* scene) {
+// Tells whether a cached hierarchy was built from the same mesh
+static uint64_t mesh_key(const Object& object) {
+    // FNV-1a over the vertex and element bytes
+    uint64_t hash = 14695981039346656037ull;
+    auto feed = [&](const void* data, size_t size) {
+        const auto bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+    };
+    feed(object.vertices.data(), object.vertices.size() * sizeof(GLfloat));
+    feed(object.elements.data(), object.elements.size() * sizeof(GLuint));
+    return hash;
+}
+
+static const char bvh_cache_magic[8] = {'B', 'V', 'H', 'C', 'A', 'C', 'H', '1'};
+
+void Model::loadHierarchies(const std::string& cache_path, WorkerPool* workers) {
+    if (objects.empty()) {
+        return;
+    }
+
+    std::vector<uint64_t> keys;
+    for (const auto& object : objects) {
+        keys.push_back(mesh_key(object));
+    }
+
+    // The cache holds the key and the hierarchy of every object in order
+    std::ifstream input(cache_path, std::ios::binary);
+    if (input) {
+        char magic[sizeof(bvh_cache_magic)];
+        uint32_t count = 0;
+        input.read(magic, sizeof(magic));
+        input.read(reinterpret_cast<char*>(&count), sizeof(count));
+
+        bool valid = input && std::equal(magic, magic + sizeof(magic), bvh_cache_magic) && count == objects.size();
+        for (size_t i = 0; valid && i < objects.size(); i++) {
+            uint64_t key = 0;
+            input.read(reinterpret_cast<char*>(&key), sizeof(key));
+            objects[i].bvh = key == keys[i] ? MeshBvh::read(input) : nullptr;
+            valid = input && objects[i].bvh != nullptr;
+        }
+        if (valid) {
+            return;
+        }
+        std::cerr << "Rebuilding stale BVH cache: " << cache_path << std::endl;
+    }
+
+    for (auto& object : objects) {
+        object.bvh = MeshBvh::build(object.vertices, object.elements, workers);
+    }
+
+    std::ofstream output(cache_path, std::ios::binary | std::ios::trunc);
+    const auto count = uint32_t(objects.size());
+    output.write(bvh_cache_magic, sizeof(bvh_cache_magic));
+    output.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (size_t i = 0; i < objects.size(); i++) {
+        output.write(reinterpret_cast<const char*>(&keys[i]), sizeof(keys[i]));
+        objects[i].bvh->write(output);
+    }
+    if (!output) {
+        // Not fatal, the hierarchies are built again on the next launch
+        std::cerr << "Couldn't write BVH cache: " << cache_path << std::endl;
+    }
+}
+
+bool Model::intersectRay(const glm::mat4& world_transform, const glm::vec3& origin, const glm::vec3& direction,
+                         float& distance) const {
+    bool hit = false;
+    for (const auto& object : objects) {
+        if (!object.bvh) continue;
+
+        // Distances along the transformed direction stay the same as long as it is not normalized
+        const auto to_object = glm::inverse(world_transform * object.getModelTransform());
+        const glm::vec3 object_origin = to_object * glm::vec4(origin, 1.0f);
+        const glm::vec3 object_direction = to_object * glm::vec4(direction, 0.0f);
+
+        hit |= object.bvh->intersect(object_origin, object_direction, distance);
+    }
+    return hit;
+}
+
+void Model::process_object(const aiNode* node, const aiScene* scene, const glm::mat4& parent_transform) {
+    // Assimp matrices are row major
+    const auto& m = node->mTransformation;
+    const auto transform = parent_transform * glm::transpose(glm::mat4(
+        m.a1, m.a2, m.a3, m.a4,
+        m.b1, m.b2, m.b3, m.b4,
+        m.c1, m.c2, m.c3, m.c4,
+        m.d1, m.d2, m.d3, m.d4
+    ));
+
     for (int i = 0; i < node->mNumMeshes; i++) {
         const auto mesh = scene->mMeshes[node->mMeshes[i]];
 
         objects.push_back(Object::create(mesh, materials[mesh->mMaterialIndex]));
+        objects.back().transform = transform;
     }
 
     for (int i = 0; i < node->mNumChildren; i++) {
-        process_object(node->mChildren[i], scene);
+        process_object(node->mChildren[i], scene, transform);
     }
 }
 
-GLuint read_texture(const std::string& path) {
+GLuint read_texture(const std::string& path, bool& has_alpha) {
     ILboolean devil_status;
     const ILuint image_id = ilGenImage();
     ilBindImage(image_id);
@@ -57,7 +148,11 @@ GLuint read_texture(const std::string& path) {
         std::cerr << "Failed to load image: " << path << std::endl;
     }
 
-    devil_status = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
+    // Alpha is kept only for the images which have it
+    const auto source_format = ilGetInteger(IL_IMAGE_FORMAT);
+    has_alpha = source_format == IL_RGBA || source_format == IL_BGRA || source_format == IL_LUMINANCE_ALPHA;
+
+    devil_status = ilConvertImage(has_alpha ? IL_RGBA : IL_RGB, IL_UNSIGNED_BYTE);
     if (!devil_status) {
         std::cerr << "Failed to convert image: " << ilGetError() << std::endl;
     }
@@ -110,7 +205,9 @@ void Model::process_textures(const aiScene* scene) {
                 material->GetTexture(texture_type, 0, &path);
 
                 const auto full_path = model_location + '/' + path.C_Str();
-                materials.emplace_back(read_texture(full_path), glm_diffuse_color, opacity);
+                bool has_alpha = false;
+                materials.emplace_back(read_texture(full_path, has_alpha), glm_diffuse_color, opacity);
+                materials.back().alpha_test = has_alpha;
             }
         }
     }
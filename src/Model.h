@@ -1,18 +1,23 @@
 #ifndef SPACEOBJECTS_MODEL_H
 #define SPACEOBJECTS_MODEL_H
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <assimp/scene.h>
-#include <glm/gtx/quaternion.hpp>
 
 #include "BBox.h"
 #include "Object.h"
+#include "WorkerPool.h"
 
+struct OccluderMesh;
+
+// Shared by every entity showing it: meshes, materials, local bounds and ray hierarchies.
+// Where an instance is and how it moves lives in the entity store
 class Model {
     std::string model_location;
 
-    void process_object(const aiNode* node, const aiScene* scene);
+    void process_object(const aiNode* node, const aiScene* scene, const glm::mat4& parent_transform);
 
     void process_textures(const aiScene* scene);
 
@@ -22,65 +27,24 @@ class Model {
 
     BBox bbox;
 
-    glm::vec3 world_pos;
-    glm::mat4 rot;
-    float scale_coef = 1.0;
+    std::shared_ptr<const OccluderMesh> occluder;  // Set for models hiding others behind them
 
     float damage = 10.0;
 
     Model() = default;
 
+    // Creates GL buffers and textures, so it runs on the GL thread
     explicit Model(const std::string& path);
 
-    void move(const glm::vec3& translation) {
-        world_pos += translation;
-    }
-
-    void rotate(float angle, const glm::vec3& axis) {
-        rot = glm::rotate(rot, angle, axis);
-    }
-
-    void scale(float coef) {
-        scale_coef *= coef;
-    }
-
-    glm::mat4 getWorldTransform() const {
-        return glm::translate(glm::mat4(1.0f), world_pos) * rot * glm::scale(glm::mat4(1.0f), glm::vec3(scale_coef));
-    }
-
-    BBox getBBox() const {
-        const auto transform = getWorldTransform();
-        return BBox(transform * glm::vec4(bbox.min, 1.0f), transform * glm::vec4(bbox.max, 1.0f));
-    }
-
-    bool dead = false;
-    int death_countdown = 60;
-
-    bool die() {
-        // ...
-
-        death_countdown--;
-        return death_countdown == 0;
-    }
-};
-
-class Asteroid : public Model {
-public:
-    glm::vec3 velocity;
-
-    Asteroid(const Model& model, const glm::vec3& velocity) :
-        Model(model),
-        velocity(velocity) {
-
-        const auto direction = glm::normalize(velocity);
-        const auto q = glm::rotation({0.0f, 0.0f, 1.0f}, direction);
-
-        rot = glm::toMat4(q) * rot;
-    }
+    // Load the triangle hierarchies for exact ray hits from the cache file or build them on the workers
+    // if given, and store them for the next launches. Touches no GL state, so it can run in a job
+    void loadHierarchies(const std::string& cache_path, WorkerPool* workers = nullptr);
 
-    void moveAuto(float alpha) {
-        world_pos += alpha * velocity;
-    }
+    // Closest hit of a world space ray with the triangles of the model placed by `world_transform`.
+    // The ray goes into the space of every object, so one hierarchy serves all instances.
+    // `distance` limits the search and is lowered to the hit. Objects without a hierarchy are skipped
+    bool intersectRay(const glm::mat4& world_transform, const glm::vec3& origin, const glm::vec3& direction,
+                      float& distance) const;
 };
 
 #endif //SPACEOBJECTS_MODEL_H
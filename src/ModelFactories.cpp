@@ -1,8 +1,8 @@
 #include "ModelFactories.h"
 
-#include <glm/gtx/norm.hpp>
+#include "OcclusionCulling.h"
 
-void ModelFactory::load() {
+void ModelFactory::load(WorkerPool* workers) {
     model_path = {
         {ModelName::E45_AIRCRAFT, "models/E-45-Aircraft/E 45 Aircraft_obj.obj"},
 //        {ModelName::ROCKET, "models/rocket/Rocket.obj"},
@@ -13,26 +13,27 @@ void ModelFactory::load() {
         {ModelName::ASTEROID1, "models/asteroid1/asteroid1.obj"},
     };
 
-    // Buffer all models
+    // Importing creates GL objects and runs on this thread. The triangle hierarchies and occluders
+    // of a model are built by the workers while the next ones are imported
+    WorkerPool serial(0);
+    auto& pool = workers != nullptr ? *workers : serial;
+
+    std::map<ModelName, WorkerPool::Counter> imported;
+    WorkerPool::Counter loaded;
     for (const auto& pair : model_path) {
-        const auto& model_name = pair.first;
+        auto& model = model_buffer[pair.first];
+        auto& counter = imported[pair.first];
         const auto& path = pair.second;
 
-        model_buffer[pair.first] = Model(path);
+        pool.submit_main([&model, &path](int) { model = Model(path); }, &counter);
+        pool.submit([&model, &path, workers](int) { model.loadHierarchies(path + ".bvh", workers); }, &loaded, &counter);
     }
-}
-
-Model
-ModelFactory::get_model(ModelName model_name, const glm::vec3 &position, const glm::vec3 &rotation, float scale) const {
-    Model model = model_buffer.at(model_name);
 
-    model.scale(scale);
-    model.move(position);
-    if (rotation != glm::vec3(0.0f)) {
-        const float angle = glm::l2Norm(rotation);
-        const auto axis = rotation / angle;
-
-        model.rotate(angle, axis);
+    // Large hulls hide a lot of the scene, their proxies are shared by all copies
+    for (const auto model_name : {ModelName::REPVENATOR}) {
+        auto& model = model_buffer[model_name];
+        pool.submit([&model](int) { model.occluder = OccluderMesh::build(model); }, &loaded, &imported[model_name]);
     }
-    return model;
+
+    pool.wait(loaded);
 }
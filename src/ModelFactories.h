@@ -19,30 +19,17 @@ class ModelFactory {
     std::map<ModelName, std::string> model_path;
     std::map<ModelName, Model> model_buffer;
 public:
-    void load();
+    // Has to be called on the GL thread, which created the workers if given.
+    // Meshes are processed on the workers, overlapping with the import of the next models
+    void load(WorkerPool* workers = nullptr);
 
-    Model get_model(ModelName model_name, const glm::vec3& position = glm::vec3(0.0f), const glm::vec3& rotation = glm::vec3(0.0f), float scale = 1.0f) const;
-
-    Model get_random_enemy(const glm::vec3& position) const {
-        const float x = rand() % 100 - 50;
-        const float y = rand() % 50 - 25;
-        const auto src = glm::vec3(x, y, -500.0f) + position;
-
-        const auto choice = static_cast<ModelName>(ModelName::REPVENATOR + rand() % 3);
-
-        return get_model(choice, src);
+    const std::map<ModelName, Model>& get_models() const {
+        return model_buffer;
     }
 
-    Asteroid get_random_asteroid(const glm::vec3& position, const glm::vec3& target) const {
-        const float x = rand() % 200 - 100;
-        const float y = rand() % 100 - 25;
-        const float scale = (rand() % 50) / 50.0f + 0.5f;
-        const auto src = glm::vec3(x, y, -500.0f) + position;
-        const glm::vec3 velocity = glm::normalize(target - src);
-
-        const auto choice = static_cast<ModelName>(ModelName::MYST_ASTEROID + rand() % 2);
-
-        return Asteroid(get_model(choice, src, glm::vec3(0.0f), scale), velocity);
+    // Shared copy of a loaded model, entities refer to it for the meshes and the local bounds
+    const Model& get_prototype(ModelName model_name) const {
+        return model_buffer.at(model_name);
     }
 };
 
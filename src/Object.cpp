@@ -8,8 +8,7 @@ Object::Object(const std::vector<float>& vertices, const std::vector<GLuint>& el
     texture_coords(texture_coords),
     normals(normals),
     material(material),
-    world_pos(0.0f, 0.0f, 0.0f),
-    rot(1.0f) {
+    transform(1.0f) {
 
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
@@ -199,7 +198,7 @@ Particles::Particles(int nb_particles) {
     glBindVertexArray(VAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, 3 * nb_particles, vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
 
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
@@ -221,18 +220,3 @@ void Crosshair::init() {
 
     glBindVertexArray(0);
 }
-
-void Laser::init() {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-
-    glBindVertexArray(VAO);
-
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, 2 * 3 * sizeof(GLfloat), nullptr, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-
-    glBindVertexArray(0);
-}
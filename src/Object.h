@@ -2,6 +2,7 @@
 #define SPACEOBJECTS_OBJECT_H
 
 #include <array>
+#include <memory>
 #include <vector>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
@@ -11,6 +12,8 @@
 
 #include "common.h"
 #include "Material.h"
+#include "LineBatch.h"
+#include "MeshBvh.h"
 
 class Object {
 protected:
@@ -23,21 +26,14 @@ public:
     std::vector<GLfloat> texture_coords;
     std::vector<GLfloat> normals;
 
-    glm::vec3 world_pos;
-    glm::mat4 rot;
+    glm::mat4 transform;  // Relative to the model, accumulated from the nodes of the imported scene
 
-    Object(const std::vector<float>& vertices, const std::vector<GLuint>& elements, const std::vector<GLfloat>& texture_coords, const Material& material, const std::vector<GLfloat>& normals);
-
-    void move(const glm::vec3& translation) {
-        world_pos += translation;
-    }
+    std::shared_ptr<const MeshBvh> bvh;  // Triangles in object space, shared by the copies of the model
 
-    void rotate(float angle, const glm::vec3& axis) {
-        rot = glm::rotate(rot, angle, axis);
-    }
+    Object(const std::vector<float>& vertices, const std::vector<GLuint>& elements, const std::vector<GLfloat>& texture_coords, const Material& material, const std::vector<GLfloat>& normals);
 
-    glm::mat4 getWorldTransform() const {
-        return glm::translate(glm::mat4(1.0f), world_pos) * rot;
+    const glm::mat4& getModelTransform() const {
+        return transform;
     }
 
     glm::vec4 getDiffuseColor() const {
@@ -52,6 +48,14 @@ public:
         return material.diffuse_texture != 0;
     }
 
+    bool alphaTest() const {
+        return material.alpha_test;
+    }
+
+    GLuint getTexture() const {
+        return material.diffuse_texture;
+    }
+
     void draw() const {
         glBindTexture(GL_TEXTURE_2D, material.diffuse_texture);
         glBindVertexArray(VAO);
@@ -134,29 +138,15 @@ public:
 };
 
 class Laser {
-    GLuint VAO, VBO;
-
 public:
     int recharge = 0;
+    glm::vec4 color = glm::vec4(1.0f, 0.2f, 0.1f, 1.0f);
 
     Laser() = default;
 
-    void init();
-
-    void draw(const glm::vec3& src, const glm::vec3& dst) const {
-        glBindVertexArray(VAO);
-
-        GLfloat vertices[] {
-            src.x, src.y, src.z,
-            dst.x, dst.y, dst.z,
-        };
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        glDrawArrays(GL_LINES, 0, 2);
-
-        glBindVertexArray(0);
+    // Lasers are collected into the frame batch and drawn together with other lines
+    void draw(LineBatch& batch, const glm::vec3& src, const glm::vec3& dst) const {
+        batch.line(src, dst, color);
     }
 };
 
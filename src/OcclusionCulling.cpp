@@ -0,0 +1,381 @@
+#include "OcclusionCulling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Model.h"
+#include "RenderCommands.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSION_USE_SSE
+#endif
+
+// Farther from the eye than the near plane z = -w of the GL clip space, which implies w > 0.
+// The GPU clips everything closer away, so it must not end up in the depth buffer either
+static bool past_near_plane(const glm::vec4& clip) {
+    return clip.z >= -clip.w;
+}
+
+std::shared_ptr<const OccluderMesh> OccluderMesh::build(const Model& model, int resolution) {
+    const auto extent = model.bbox.max - model.bbox.min;
+    const float longest = std::max(extent.x, std::max(extent.y, extent.z));
+    const float cell = std::max(longest / float(resolution), 1e-6f);
+    const glm::ivec3 cells = glm::max(glm::ivec3(glm::ceil(extent / cell)), glm::ivec3(1));
+
+    auto mesh = std::make_shared<OccluderMesh>();
+    std::vector<int> counts;
+    std::vector<glm::vec3> normals;  // Sum of the area weighted normals of the triangles around every cluster
+    std::vector<float> areas;
+    std::unordered_map<int, uint32_t> cell_vertex;
+    std::unordered_set<uint64_t> seen;
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> remap;
+    std::vector<uint32_t> indices;
+
+    for (const auto& object : model.objects) {
+        // Vertices falling into the same cell are merged into their average
+        positions.resize(object.vertices.size() / 3);
+        remap.resize(positions.size());
+        for (size_t i = 0; i < remap.size(); i++) {
+            const glm::vec3 vertex = object.getModelTransform()
+                                   * glm::vec4(object.vertices[3 * i], object.vertices[3 * i + 1], object.vertices[3 * i + 2], 1.0f);
+            const auto coords = glm::clamp(glm::ivec3((vertex - model.bbox.min) / cell), glm::ivec3(0), cells - 1);
+            const int id = coords.x + cells.x * (coords.y + cells.y * coords.z);
+
+            positions[i] = vertex;
+            const auto it = cell_vertex.find(id);
+            if (it == cell_vertex.end()) {
+                remap[i] = uint32_t(mesh->vertices.size());
+                cell_vertex[id] = remap[i];
+                mesh->vertices.push_back(vertex);
+                counts.push_back(1);
+                normals.push_back(glm::vec3(0.0f));
+                areas.push_back(0.0f);
+            } else {
+                remap[i] = it->second;
+                mesh->vertices[it->second] += vertex;
+                counts[it->second]++;
+            }
+        }
+
+        for (size_t i = 0; i + 2 < object.elements.size(); i += 3) {
+            uint32_t corners[3] = {remap[object.elements[i]], remap[object.elements[i + 1]], remap[object.elements[i + 2]]};
+
+            const auto& a = positions[object.elements[i]];
+            const auto normal = glm::cross(positions[object.elements[i + 1]] - a, positions[object.elements[i + 2]] - a);
+            for (const auto corner : corners) {
+                normals[corner] += normal;
+                areas[corner] += glm::length(normal);
+            }
+
+            // Triangles collapsed into a line or a point are dropped, as well as duplicates
+            if (corners[0] == corners[1] || corners[1] == corners[2] || corners[0] == corners[2]) continue;
+
+            uint32_t sorted[3] = {corners[0], corners[1], corners[2]};
+            std::sort(sorted, sorted + 3);
+            const uint64_t key = (uint64_t(sorted[0]) << 42) | (uint64_t(sorted[1]) << 21) | uint64_t(sorted[2]);
+            if (!seen.insert(key).second) continue;
+
+            indices.insert(indices.end(), corners, corners + 3);
+        }
+    }
+
+    // The average of a cell may stick out of the hull where it is concave, and the proxy triangles
+    // may span gaps between parts, so an occluder could hide visible models. Every cluster is pulled
+    // inward by half a cell along its normal, outward facing triangles assumed, to stay behind the surface.
+    // Clusters whose normals cancel out sit on parts thinner than a cell, they are dropped with their triangles
+    const uint32_t dropped = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> kept(mesh->vertices.size(), dropped);
+    std::vector<glm::vec3> vertices;
+    for (size_t i = 0; i < mesh->vertices.size(); i++) {
+        const float length = glm::length(normals[i]);
+        if (length <= 0.5f * areas[i]) continue;
+
+        kept[i] = uint32_t(vertices.size());
+        vertices.push_back(mesh->vertices[i] / float(counts[i]) - normals[i] * (0.5f * cell / length));
+    }
+    mesh->vertices.swap(vertices);
+
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        const uint32_t corners[3] = {kept[indices[i]], kept[indices[i + 1]], kept[indices[i + 2]]};
+        if (corners[0] == dropped || corners[1] == dropped || corners[2] == dropped) continue;
+
+        mesh->indices.insert(mesh->indices.end(), corners, corners + 3);
+    }
+
+    return mesh;
+}
+
+void OcclusionCuller::init(WorkerPool* workers) {
+    this->workers = workers;
+
+    glm::ivec2 size(width, height);
+    levels.emplace_back(size_t(width * height), 1.0f);
+    level_sizes.push_back(size);
+
+    while (size.x > 1 || size.y > 1) {
+        size = glm::max((size + 1) / 2, glm::ivec2(1));
+        levels.emplace_back(size_t(size.x * size.y), 1.0f);
+        level_sizes.push_back(size);
+    }
+}
+
+// Pixel coordinates and depth in [0, 1], rows go from the bottom
+static glm::vec3 to_screen(const glm::vec4& clip) {
+    const auto ndc = glm::vec3(clip) / clip.w;
+    return glm::vec3(
+        (0.5f * ndc.x + 0.5f) * float(OcclusionCuller::width),
+        (0.5f * ndc.y + 0.5f) * float(OcclusionCuller::height),
+        0.5f * ndc.z + 0.5f
+    );
+}
+
+void OcclusionCuller::setup_triangle(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2) {
+    glm::vec3 p[3] = {to_screen(v0), to_screen(v1), to_screen(v2)};
+
+    float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+    if (std::fabs(area) < 1e-6f) {
+        return;
+    }
+    // Both sides of the proxies are drawn, their winding isn't reliable after clustering
+    if (area < 0.0f) {
+        std::swap(p[1], p[2]);
+        area = -area;
+    }
+
+    Triangle triangle;
+
+    const auto low = glm::min(p[0], glm::min(p[1], p[2]));
+    const auto high = glm::max(p[0], glm::max(p[1], p[2]));
+    triangle.bounds = glm::ivec4(
+        std::max(int(std::floor(low.x)), 0),
+        std::max(int(std::floor(low.y)), 0),
+        std::min(int(std::floor(high.x)), width - 1),
+        std::min(int(std::floor(high.y)), height - 1)
+    );
+    if (triangle.bounds.x > triangle.bounds.z || triangle.bounds.y > triangle.bounds.w) {
+        return;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        const auto& a = p[(i + 1) % 3];
+        const auto& b = p[(i + 2) % 3];
+        const float dx = a.y - b.y;
+        const float dy = b.x - a.x;
+        triangle.edge[i] = glm::vec3(dx, dy, -dx * a.x - dy * a.y);
+    }
+
+    const auto e1 = p[1] - p[0];
+    const auto e2 = p[2] - p[0];
+    const float dzdx = (e1.z * e2.y - e2.z * e1.y) / area;
+    const float dzdy = (e2.z * e1.x - e1.z * e2.x) / area;
+    triangle.depth = glm::vec3(dzdx, dzdy, p[0].z - dzdx * p[0].x - dzdy * p[0].y);
+
+    const auto index = uint32_t(triangles.size());
+    triangles.push_back(triangle);
+
+    for (int ty = triangle.bounds.y / tile_height; ty <= triangle.bounds.w / tile_height; ty++) {
+        for (int tx = triangle.bounds.x / tile_width; tx <= triangle.bounds.z / tile_width; tx++) {
+            bins[ty * tiles_x + tx].push_back(index);
+        }
+    }
+}
+
+void OcclusionCuller::rasterize_tile(int tile) {
+    const int x0 = (tile % tiles_x) * tile_width;
+    const int y0 = (tile / tiles_x) * tile_height;
+    auto& depth = levels[0];
+
+    for (int y = y0; y < y0 + tile_height; y++) {
+        std::fill(depth.begin() + y * width + x0, depth.begin() + y * width + x0 + tile_width, 1.0f);
+    }
+
+    for (const auto index : bins[tile]) {
+        const auto& triangle = triangles[index];
+
+        // Start at a multiple of the SIMD width, the tile is made of whole vectors
+        const int min_x = std::max(triangle.bounds.x, x0) & ~3;
+        const int max_x = std::min(triangle.bounds.z, x0 + tile_width - 1);
+        const int min_y = std::max(triangle.bounds.y, y0);
+        const int max_y = std::min(triangle.bounds.w, y0 + tile_height - 1);
+
+        const auto& e0 = triangle.edge[0];
+        const auto& e1 = triangle.edge[1];
+        const auto& e2 = triangle.edge[2];
+        const auto& z = triangle.depth;
+
+#ifdef OCCLUSION_USE_SSE
+        const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 a0 = _mm_set1_ps(e0.x), a1 = _mm_set1_ps(e1.x), a2 = _mm_set1_ps(e2.x);
+        const __m128 az = _mm_set1_ps(z.x);
+
+        for (int y = min_y; y <= max_y; y++) {
+            const float py = float(y) + 0.5f;
+            const __m128 r0 = _mm_set1_ps(e0.y * py + e0.z);
+            const __m128 r1 = _mm_set1_ps(e1.y * py + e1.z);
+            const __m128 r2 = _mm_set1_ps(e2.y * py + e2.z);
+            const __m128 rz = _mm_set1_ps(z.y * py + z.z);
+            float* row = depth.data() + y * width;
+
+            for (int x = min_x; x <= max_x; x += 4) {
+                const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+
+                const __m128 inside = _mm_and_ps(
+                    _mm_and_ps(
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, px), r0), zero),
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, px), r1), zero)),
+                    _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, px), r2), zero));
+                if (_mm_movemask_ps(inside) == 0) continue;
+
+                const __m128 old = _mm_loadu_ps(row + x);
+                const __m128 closer = _mm_min_ps(old, _mm_add_ps(_mm_mul_ps(az, px), rz));
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, old)));
+            }
+        }
+#else
+        for (int y = min_y; y <= max_y; y++) {
+            const float py = float(y) + 0.5f;
+            float* row = depth.data() + y * width;
+
+            for (int x = min_x; x <= max_x; x++) {
+                const float px = float(x) + 0.5f;
+                if (e0.x * px + e0.y * py + e0.z < 0.0f
+                 || e1.x * px + e1.y * py + e1.z < 0.0f
+                 || e2.x * px + e2.y * py + e2.z < 0.0f) continue;
+
+                row[x] = std::min(row[x], z.x * px + z.y * py + z.z);
+            }
+        }
+#endif
+    }
+}
+
+void OcclusionCuller::build_pyramid() {
+    for (size_t level = 1; level < levels.size(); level++) {
+        const auto& below = levels[level - 1];
+        const auto below_size = level_sizes[level - 1];
+        auto& current = levels[level];
+        const auto size = level_sizes[level];
+
+        for (int y = 0; y < size.y; y++) {
+            const int y0 = 2 * y;
+            const int y1 = std::min(y0 + 1, below_size.y - 1);
+
+            for (int x = 0; x < size.x; x++) {
+                const int x0 = 2 * x;
+                const int x1 = std::min(x0 + 1, below_size.x - 1);
+
+                current[y * size.x + x] = std::max(
+                    std::max(below[y0 * below_size.x + x0], below[y0 * below_size.x + x1]),
+                    std::max(below[y1 * below_size.x + x0], below[y1 * below_size.x + x1])
+                );
+            }
+        }
+    }
+}
+
+void OcclusionCuller::render(const FrameVector<SceneItem>& scene, const glm::mat4& view_projection) {
+    const auto start = std::chrono::steady_clock::now();
+
+    stats = Stats();
+    triangles.clear();
+    for (auto& bin : bins) {
+        bin.clear();
+    }
+
+    for (const auto& item : scene) {
+        if (!item.model->occluder) continue;
+        stats.occluders++;
+
+        const auto transform = view_projection * item.world;
+        const auto& mesh = *item.model->occluder;
+
+        clip_vertices.resize(mesh.vertices.size());
+        for (size_t i = 0; i < mesh.vertices.size(); i++) {
+            clip_vertices[i] = transform * glm::vec4(mesh.vertices[i], 1.0f);
+        }
+
+        // Triangles with a vertex closer than the near plane are skipped instead of clipped,
+        // an occluder can only hide less because of that
+        for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+            const auto& v0 = clip_vertices[mesh.indices[i]];
+            const auto& v1 = clip_vertices[mesh.indices[i + 1]];
+            const auto& v2 = clip_vertices[mesh.indices[i + 2]];
+            if (!past_near_plane(v0) || !past_near_plane(v1) || !past_near_plane(v2)) continue;
+
+            setup_triangle(v0, v1, v2);
+        }
+    }
+
+    // Every tile belongs to a single worker, so no synchronization of the depth buffer is needed
+    workers->parallel_for(size_t(tiles_x * tiles_y), 1, [this](size_t begin, size_t end, int) {
+        for (size_t tile = begin; tile < end; tile++) {
+            rasterize_tile(int(tile));
+        }
+    });
+
+    build_pyramid();
+    ready = true;
+
+    stats.triangles = triangles.size();
+    stats.raster_time = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool OcclusionCuller::occluded(const BBox& bbox, const glm::mat4& transform) const {
+    if (!ready) {
+        return false;
+    }
+
+    glm::vec2 low(std::numeric_limits<float>::max());
+    glm::vec2 high(std::numeric_limits<float>::lowest());
+    float nearest = 1.0f;
+
+    for (int i = 0; i < 8; i++) {
+        const glm::vec3 corner(
+            (i & 1) ? bbox.max.x : bbox.min.x,
+            (i & 2) ? bbox.max.y : bbox.min.y,
+            (i & 4) ? bbox.max.z : bbox.min.z
+        );
+        const auto clip = transform * glm::vec4(corner, 1.0f);
+        if (!past_near_plane(clip)) {
+            return false;  // Crosses the near plane, can't be tested
+        }
+
+        const auto screen = to_screen(clip);
+        low = glm::min(low, glm::vec2(screen));
+        high = glm::max(high, glm::vec2(screen));
+        nearest = std::min(nearest, screen.z);
+    }
+
+    const int x0 = std::max(int(std::floor(low.x)), 0);
+    const int y0 = std::max(int(std::floor(low.y)), 0);
+    const int x1 = std::min(int(std::floor(high.x)), width - 1);
+    const int y1 = std::min(int(std::floor(high.y)), height - 1);
+    if (x0 > x1 || y0 > y1) {
+        return false;  // Off screen, left to frustum culling
+    }
+
+    // Coarsest level where the rectangle still covers only a few texels
+    size_t level = 0;
+    const int extent = std::max(x1 - x0, y1 - y0) + 1;
+    while ((extent >> level) > 4 && level + 1 < levels.size()) {
+        level++;
+    }
+
+    const auto& depth = levels[level];
+    const auto size = level_sizes[level];
+    float farthest = 0.0f;
+    for (int y = y0 >> level; y <= (y1 >> level); y++) {
+        for (int x = x0 >> level; x <= (x1 >> level); x++) {
+            farthest = std::max(farthest, depth[y * size.x + x]);
+        }
+    }
+
+    return nearest > farthest;
+}
@@ -0,0 +1,92 @@
+#ifndef SPACEOBJECTS_OCCLUSIONCULLING_H
+#define SPACEOBJECTS_OCCLUSIONCULLING_H
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "BBox.h"
+#include "FrameArena.h"
+#include "WorkerPool.h"
+
+class Model;
+struct SceneItem;
+
+// Low poly stand-in of a model used for rasterizing occluders on the CPU
+struct OccluderMesh {
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> indices;
+
+    // Simplify all meshes of the model by vertex clustering on a grid with
+    // `resolution` cells along the longest side of the bounding box.
+    // The result stays inside the hull, so it never hides what the model doesn't
+    static std::shared_ptr<const OccluderMesh> build(const Model& model, int resolution = 16);
+};
+
+// Software occlusion culling.
+// Occluder proxies of the scene are rasterized into a small depth buffer on the CPU.
+// Triangles are binned into screen tiles, tiles are rasterized in parallel on the
+// workers, four pixels at a time with SSE. A max depth pyramid is built on top,
+// and bounding boxes are tested against the level where they cover a few texels.
+class OcclusionCuller {
+public:
+    static constexpr int width = 320;
+    static constexpr int height = 180;
+    static constexpr int tile_width = 32;   // Multiple of the SIMD width
+    static constexpr int tile_height = 20;
+    static constexpr int tiles_x = width / tile_width;
+    static constexpr int tiles_y = height / tile_height;
+
+    struct Stats {
+        size_t occluders = 0;
+        size_t triangles = 0;    // Rasterized, after near plane rejection
+        float raster_time = 0;   // Milliseconds of CPU time for the rasterization and the pyramid
+    };
+
+private:
+    // Screen space triangle, counter clockwise: edge functions and depth plane
+    struct Triangle {
+        glm::vec3 edge[3];       // a * x + b * y + c >= 0 inside
+        glm::vec3 depth;         // z = a * x + b * y + c
+        glm::ivec4 bounds;       // Pixel rectangle: min x, min y, max x, max y
+    };
+
+    WorkerPool* workers = nullptr;
+
+    std::vector<glm::vec4> clip_vertices;  // Scratch space of the current occluder
+    std::vector<Triangle> triangles;
+    std::array<std::vector<uint32_t>, tiles_x * tiles_y> bins;
+
+    // Level 0 is the depth buffer, the next ones keep the farthest depth of 2x2 texels below
+    std::vector<std::vector<float>> levels;
+    std::vector<glm::ivec2> level_sizes;
+
+    bool ready = false;
+    Stats stats;
+
+    void setup_triangle(const glm::vec4& v0, const glm::vec4& v1, const glm::vec4& v2);
+
+    void rasterize_tile(int tile);
+
+    void build_pyramid();
+
+public:
+    OcclusionCuller() = default;
+
+    void init(WorkerPool* workers);
+
+    // Rasterize the occluders among the scene items as seen through view_projection
+    void render(const FrameVector<SceneItem>& scene, const glm::mat4& view_projection);
+
+    // True if the box is certainly hidden behind the occluders.
+    // `transform` is the view projection of the last render times the model transform
+    bool occluded(const BBox& bbox, const glm::mat4& transform) const;
+
+    const Stats& get_stats() const {
+        return stats;
+    }
+};
+
+#endif //SPACEOBJECTS_OCCLUSIONCULLING_H
@@ -0,0 +1,208 @@
+#include "ParticleSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define PARTICLES_USE_SSE
+#endif
+
+static GLuint pack_color(const glm::vec4& color) {
+    const auto c = glm::clamp(color, 0.0f, 1.0f) * 255.0f;
+    return GLuint(c.x) | GLuint(c.y) << 8 | GLuint(c.z) << 16 | GLuint(c.w) << 24;
+}
+
+ParticleSystem::ParticleSystem(size_t capacity) : capacity(capacity) {
+    const size_t padded = (capacity + 3) & ~size_t(3);
+
+    for (auto array : {&pos_x, &pos_y, &pos_z, &vel_x, &vel_y, &vel_z, &life, &inv_lifetime}) {
+        array->assign(padded, 0.0f);
+    }
+    color.assign(capacity, 0);
+    staging.resize(capacity);
+
+    for (auto& emitter : emitters) {
+        emitter.active = false;
+    }
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+
+    glBindVertexArray(VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GPUParticle), nullptr, GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), (void*) offsetof(GPUParticle, x));
+
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, sizeof(GPUParticle), (void*) offsetof(GPUParticle, life));
+
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(GPUParticle), (void*) offsetof(GPUParticle, color));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+float ParticleSystem::random() {
+    // xorshift32
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return float(random_state >> 8) * (1.0f / 16777216.0f);
+}
+
+bool ParticleSystem::burst(const glm::vec3& position, const glm::vec3& velocity, int amount, const glm::vec4& color,
+                           float speed, float lifetime, float duration) {
+    Emitter emitter;
+    emitter.position = position;
+    emitter.velocity = velocity;
+    emitter.color = color;
+    emitter.speed = speed;
+    emitter.lifetime = lifetime;
+    emitter.accumulator = 0.0f;
+
+    if (duration <= 0.0f) {
+        spawn(emitter, amount);
+        return true;
+    }
+
+    for (auto& slot : emitters) {
+        if (!slot.active) {
+            emitter.rate = amount / duration;
+            emitter.remaining = amount;
+            emitter.active = true;
+            slot = emitter;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ParticleSystem::spawn(const Emitter& emitter, int amount) {
+    const auto n = std::min(size_t(std::max(amount, 0)), capacity - count);
+
+    for (size_t i = count; i < count + n; i++) {
+        // Random direction, speed is distributed towards the center for a denser core
+        const float dx = 2.0f * random() - 1.0f;
+        const float dy = 2.0f * random() - 1.0f;
+        const float dz = 2.0f * random() - 1.0f;
+        const float scale = emitter.speed * random() / (std::sqrt(dx * dx + dy * dy + dz * dz) + 1e-6f);
+
+        pos_x[i] = emitter.position.x;
+        pos_y[i] = emitter.position.y;
+        pos_z[i] = emitter.position.z;
+
+        vel_x[i] = emitter.velocity.x + scale * dx;
+        vel_y[i] = emitter.velocity.y + scale * dy;
+        vel_z[i] = emitter.velocity.z + scale * dz;
+
+        life[i] = 1.0f;
+        inv_lifetime[i] = 1.0f / (emitter.lifetime * (0.5f + 0.5f * random()));
+
+        const float tint = 0.75f + 0.25f * random();
+        color[i] = pack_color(glm::vec4(glm::vec3(emitter.color) * tint, emitter.color.w));
+    }
+
+    count += n;
+}
+
+void ParticleSystem::integrate(float dt) {
+    const float damping_step = std::pow(damping, dt);
+
+#ifdef PARTICLES_USE_SSE
+    const __m128 step = _mm_set1_ps(dt);
+    const __m128 damp = _mm_set1_ps(damping_step);
+
+    // Arrays are padded, so the tail may be processed as a whole vector
+    for (size_t i = 0; i < count; i += 4) {
+        const __m128 vx = _mm_mul_ps(_mm_loadu_ps(&vel_x[i]), damp);
+        const __m128 vy = _mm_mul_ps(_mm_loadu_ps(&vel_y[i]), damp);
+        const __m128 vz = _mm_mul_ps(_mm_loadu_ps(&vel_z[i]), damp);
+
+        _mm_storeu_ps(&vel_x[i], vx);
+        _mm_storeu_ps(&vel_y[i], vy);
+        _mm_storeu_ps(&vel_z[i], vz);
+
+        _mm_storeu_ps(&pos_x[i], _mm_add_ps(_mm_loadu_ps(&pos_x[i]), _mm_mul_ps(vx, step)));
+        _mm_storeu_ps(&pos_y[i], _mm_add_ps(_mm_loadu_ps(&pos_y[i]), _mm_mul_ps(vy, step)));
+        _mm_storeu_ps(&pos_z[i], _mm_add_ps(_mm_loadu_ps(&pos_z[i]), _mm_mul_ps(vz, step)));
+
+        const __m128 decay = _mm_mul_ps(_mm_loadu_ps(&inv_lifetime[i]), step);
+        _mm_storeu_ps(&life[i], _mm_sub_ps(_mm_loadu_ps(&life[i]), decay));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        vel_x[i] *= damping_step;
+        vel_y[i] *= damping_step;
+        vel_z[i] *= damping_step;
+
+        pos_x[i] += vel_x[i] * dt;
+        pos_y[i] += vel_y[i] * dt;
+        pos_z[i] += vel_z[i] * dt;
+
+        life[i] -= inv_lifetime[i] * dt;
+    }
+#endif
+}
+
+void ParticleSystem::kill_expired() {
+    // Swap-remove keeps the alive particles packed at the front
+    size_t i = 0;
+    while (i < count) {
+        if (life[i] > 0.0f) {
+            i++;
+            continue;
+        }
+
+        const auto last = --count;
+        pos_x[i] = pos_x[last];
+        pos_y[i] = pos_y[last];
+        pos_z[i] = pos_z[last];
+        vel_x[i] = vel_x[last];
+        vel_y[i] = vel_y[last];
+        vel_z[i] = vel_z[last];
+        life[i] = life[last];
+        inv_lifetime[i] = inv_lifetime[last];
+        color[i] = color[last];
+    }
+}
+
+void ParticleSystem::update(float dt) {
+    for (auto& emitter : emitters) {
+        if (!emitter.active) continue;
+
+        emitter.accumulator += emitter.rate * dt;
+        const int amount = std::min(int(emitter.accumulator), emitter.remaining);
+        emitter.accumulator -= amount;
+        emitter.remaining -= amount;
+
+        spawn(emitter, amount);
+
+        emitter.position += emitter.velocity * dt;
+        emitter.active = emitter.remaining > 0;
+    }
+
+    integrate(dt);
+    kill_expired();
+}
+
+void ParticleSystem::upload() {
+    for (size_t i = 0; i < count; i++) {
+        staging[i] = {pos_x[i], pos_y[i], pos_z[i], life[i], color[i]};
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    // Orphan the previous storage, the GPU may still be drawing from it
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(GPUParticle), nullptr, GL_STREAM_DRAW);
+    if (count > 0) {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(GPUParticle), staging.data());
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    GL_CHECK_ERRORS;
+}
@@ -0,0 +1,99 @@
+#ifndef SPACEOBJECTS_PARTICLESYSTEM_H
+#define SPACEOBJECTS_PARTICLESYSTEM_H
+
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+
+// Explosion and spark particles.
+// All storage is allocated once in the constructor: particles live in SoA arrays
+// of fixed capacity and emitters come from a fixed pool, so spawning and killing
+// never touches the heap. Integration is vectorized with SSE, the whole pool is
+// uploaded to the GPU with one streaming write per frame.
+class ParticleSystem {
+public:
+    static constexpr int max_emitters = 64;
+
+    struct Emitter {
+        glm::vec3 position;
+        glm::vec3 velocity;   // Inherited by every spawned particle
+        glm::vec4 color;
+        float speed;          // Max speed of particles relative to the emitter
+        float lifetime;       // Max lifetime of spawned particles in seconds
+        float rate;           // Particles per second
+        float accumulator;
+        int remaining;
+        bool active;
+    };
+
+private:
+    struct GPUParticle {
+        GLfloat x, y, z;
+        GLfloat life;         // Remaining fraction of lifetime
+        GLuint color;         // RGBA8
+    };
+
+    GLuint VAO = 0, VBO = 0;
+
+    size_t capacity = 0;
+    size_t count = 0;
+
+    // Particle storage, arrays are padded to a multiple of the SIMD width
+    std::vector<float> pos_x, pos_y, pos_z;
+    std::vector<float> vel_x, vel_y, vel_z;
+    std::vector<float> life, inv_lifetime;
+    std::vector<GLuint> color;
+
+    std::array<Emitter, max_emitters> emitters;
+
+    std::vector<GPUParticle> staging;
+
+    uint32_t random_state = 0x9E3779B9u;
+
+    float random();  // Uniform in [0, 1)
+
+    void spawn(const Emitter& emitter, int amount);
+
+    void integrate(float dt);
+
+    void kill_expired();
+
+public:
+    float damping = 0.98f;  // Velocity multiplier per second
+
+    ParticleSystem() = default;
+
+    explicit ParticleSystem(size_t capacity);
+
+    // Emit `amount` particles from `position` over `duration` seconds. Returns false if the emitter pool is full
+    bool burst(const glm::vec3& position, const glm::vec3& velocity, int amount, const glm::vec4& color,
+               float speed = 5.0f, float lifetime = 1.5f, float duration = 0.0f);
+
+    void update(float dt);
+
+    // Stream the alive particles into the vertex buffer
+    void upload();
+
+    size_t size() const {
+        return count;
+    }
+
+    void draw() const {
+        if (count == 0) {
+            return;
+        }
+
+        glBindVertexArray(VAO);
+
+        glDrawArrays(GL_POINTS, 0, GLsizei(count));
+        GL_CHECK_ERRORS;
+
+        glBindVertexArray(0);
+    }
+};
+
+#endif //SPACEOBJECTS_PARTICLESYSTEM_H
@@ -0,0 +1,181 @@
+#include "RayQuery.h"
+
+#include <limits>
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define RAY_QUERY_AVX512
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define RAY_QUERY_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define RAY_QUERY_SSE
+#endif
+
+// Padding boxes are points out there: every slab puts them either behind the ray or beyond any distance
+static const float far_away = 1e30f;
+
+void PackedBounds::assign(const BBox* boxes, size_t count) {
+    this->count = count;
+    const size_t padded = (count + padding - 1) / padding * padding;
+
+    for (auto array : {&min_x, &min_y, &min_z, &max_x, &max_y, &max_z}) {
+        array->assign(padded, far_away);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        min_x[i] = boxes[i].min.x;
+        min_y[i] = boxes[i].min.y;
+        min_z[i] = boxes[i].min.z;
+        max_x[i] = boxes[i].max.x;
+        max_y[i] = boxes[i].max.y;
+        max_z[i] = boxes[i].max.z;
+    }
+}
+
+void PackedBounds::disable(size_t index) {
+    min_x[index] = min_y[index] = min_z[index] = far_away;
+    max_x[index] = max_y[index] = max_z[index] = far_away;
+}
+
+RayHit intersect_nearest(const PackedBounds& bounds, const glm::vec3& origin, const glm::vec3& direction,
+                         float max_distance) {
+    const glm::vec3 inverse = 1.0f / direction;
+    const size_t padded = bounds.min_x.size();
+
+    RayHit hit = {bounds.size(), max_distance};
+
+#if defined(RAY_QUERY_AVX512)
+    const __m512 ox = _mm512_set1_ps(origin.x), oy = _mm512_set1_ps(origin.y), oz = _mm512_set1_ps(origin.z);
+    const __m512 ix = _mm512_set1_ps(inverse.x), iy = _mm512_set1_ps(inverse.y), iz = _mm512_set1_ps(inverse.z);
+    const __m512 lane = _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m512 best = _mm512_set1_ps(max_distance);
+    __m512 best_index = _mm512_set1_ps(-1.0f);
+
+    for (size_t i = 0; i < padded; i += 16) {
+        const __m512 x0 = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&bounds.min_x[i]), ox), ix);
+        const __m512 x1 = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&bounds.max_x[i]), ox), ix);
+        const __m512 y0 = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&bounds.min_y[i]), oy), iy);
+        const __m512 y1 = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&bounds.max_y[i]), oy), iy);
+        const __m512 z0 = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&bounds.min_z[i]), oz), iz);
+        const __m512 z1 = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(&bounds.max_z[i]), oz), iz);
+
+        __m512 near = _mm512_max_ps(_mm512_max_ps(_mm512_min_ps(x0, x1), _mm512_min_ps(y0, y1)), _mm512_min_ps(z0, z1));
+        const __m512 far = _mm512_min_ps(_mm512_min_ps(_mm512_max_ps(x0, x1), _mm512_max_ps(y0, y1)), _mm512_max_ps(z0, z1));
+        near = _mm512_max_ps(near, _mm512_setzero_ps());
+
+        // Hit in front of the origin and closer than the best one of the lane so far
+        const __mmask16 closer = _mm512_cmp_ps_mask(near, far, _CMP_LE_OQ) & _mm512_cmp_ps_mask(near, best, _CMP_LT_OQ);
+        best = _mm512_mask_blend_ps(closer, best, near);
+        best_index = _mm512_mask_blend_ps(closer, best_index, _mm512_add_ps(lane, _mm512_set1_ps(float(i))));
+    }
+
+    float distances[16], indices[16];
+    _mm512_storeu_ps(distances, best);
+    _mm512_storeu_ps(indices, best_index);
+    const int lanes = 16;
+#elif defined(RAY_QUERY_AVX)
+    const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+    const __m256 ix = _mm256_set1_ps(inverse.x), iy = _mm256_set1_ps(inverse.y), iz = _mm256_set1_ps(inverse.z);
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 best = _mm256_set1_ps(max_distance);
+    __m256 best_index = _mm256_set1_ps(-1.0f);
+
+    for (size_t i = 0; i < padded; i += 8) {
+        const __m256 x0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.min_x[i]), ox), ix);
+        const __m256 x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.max_x[i]), ox), ix);
+        const __m256 y0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.min_y[i]), oy), iy);
+        const __m256 y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.max_y[i]), oy), iy);
+        const __m256 z0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.min_z[i]), oz), iz);
+        const __m256 z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(&bounds.max_z[i]), oz), iz);
+
+        __m256 near = _mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_min_ps(z0, z1));
+        const __m256 far = _mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_max_ps(z0, z1));
+        near = _mm256_max_ps(near, _mm256_setzero_ps());
+
+        const __m256 closer = _mm256_and_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ), _mm256_cmp_ps(near, best, _CMP_LT_OQ));
+        best = _mm256_blendv_ps(best, near, closer);
+        best_index = _mm256_blendv_ps(best_index, _mm256_add_ps(lane, _mm256_set1_ps(float(i))), closer);
+    }
+
+    float distances[8], indices[8];
+    _mm256_storeu_ps(distances, best);
+    _mm256_storeu_ps(indices, best_index);
+    const int lanes = 8;
+#elif defined(RAY_QUERY_SSE)
+    const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+    const __m128 ix = _mm_set1_ps(inverse.x), iy = _mm_set1_ps(inverse.y), iz = _mm_set1_ps(inverse.z);
+    const __m128 lane = _mm_setr_ps(0, 1, 2, 3);
+    __m128 best = _mm_set1_ps(max_distance);
+    __m128 best_index = _mm_set1_ps(-1.0f);
+
+    for (size_t i = 0; i < padded; i += 4) {
+        const __m128 x0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.min_x[i]), ox), ix);
+        const __m128 x1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.max_x[i]), ox), ix);
+        const __m128 y0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.min_y[i]), oy), iy);
+        const __m128 y1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.max_y[i]), oy), iy);
+        const __m128 z0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.min_z[i]), oz), iz);
+        const __m128 z1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bounds.max_z[i]), oz), iz);
+
+        __m128 near = _mm_max_ps(_mm_max_ps(_mm_min_ps(x0, x1), _mm_min_ps(y0, y1)), _mm_min_ps(z0, z1));
+        const __m128 far = _mm_min_ps(_mm_min_ps(_mm_max_ps(x0, x1), _mm_max_ps(y0, y1)), _mm_max_ps(z0, z1));
+        near = _mm_max_ps(near, _mm_setzero_ps());
+
+        // SSE has no blend, select with the mask bits
+        const __m128 closer = _mm_and_ps(_mm_cmple_ps(near, far), _mm_cmplt_ps(near, best));
+        best = _mm_or_ps(_mm_and_ps(closer, near), _mm_andnot_ps(closer, best));
+        const __m128 index = _mm_add_ps(lane, _mm_set1_ps(float(i)));
+        best_index = _mm_or_ps(_mm_and_ps(closer, index), _mm_andnot_ps(closer, best_index));
+    }
+
+    float distances[4], indices[4];
+    _mm_storeu_ps(distances, best);
+    _mm_storeu_ps(indices, best_index);
+    const int lanes = 4;
+#else
+    float distances[1] = {max_distance};
+    float indices[1] = {-1.0f};
+    const int lanes = 1;
+
+    for (size_t i = 0; i < padded; i++) {
+        const BBox box(glm::vec3(bounds.min_x[i], bounds.min_y[i], bounds.min_z[i]),
+                       glm::vec3(bounds.max_x[i], bounds.max_y[i], bounds.max_z[i]));
+        const auto t0 = (box.min - origin) * inverse;
+        const auto t1 = (box.max - origin) * inverse;
+        const auto near_planes = glm::min(t0, t1);
+        const auto far_planes = glm::max(t0, t1);
+
+        const float near = glm::max(glm::max(near_planes.x, glm::max(near_planes.y, near_planes.z)), 0.0f);
+        const float far = glm::min(far_planes.x, glm::min(far_planes.y, far_planes.z));
+        if (near <= far && near < distances[0]) {
+            distances[0] = near;
+            indices[0] = float(i);
+        }
+    }
+#endif
+
+    // Box indices are exact in floats up to 2^24
+    for (int i = 0; i < lanes; i++) {
+        if (indices[i] >= 0.0f && distances[i] < hit.distance) {
+            hit.index = size_t(indices[i]);
+            hit.distance = distances[i];
+        }
+    }
+    if (hit.index == bounds.size()) {
+        hit.distance = max_distance;
+    }
+    return hit;
+}
+
+const char* ray_query_isa() {
+#if defined(RAY_QUERY_AVX512)
+    return "AVX-512";
+#elif defined(RAY_QUERY_AVX)
+    return "AVX";
+#elif defined(RAY_QUERY_SSE)
+    return "SSE";
+#else
+    return "scalar";
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef SPACEOBJECTS_RAYQUERY_H
+#define SPACEOBJECTS_RAYQUERY_H
+
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "BBox.h"
+
+// Boxes in structure of arrays layout, for testing one ray against a whole SIMD register of boxes.
+// The arrays are padded to a multiple of the widest register with far away points no ray can hit
+class PackedBounds {
+public:
+    static constexpr size_t padding = 16;  // Floats in an AVX-512 register
+
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+
+private:
+    size_t count = 0;
+
+public:
+    void assign(const BBox* boxes, size_t count);
+
+    // Exclude a box from the queries, its index stays
+    void disable(size_t index);
+
+    size_t size() const {
+        return count;
+    }
+};
+
+struct RayHit {
+    size_t index;    // Number of boxes if nothing was hit
+    float distance;  // In lengths of the direction, 0 if the origin is inside the box
+};
+
+// Nearest box with an intersection in [0, max_distance] along the ray.
+// Four, eight or sixteen boxes are tested per instruction with SSE, AVX or AVX-512,
+// depending on what the compiler targets
+RayHit intersect_nearest(const PackedBounds& bounds, const glm::vec3& origin, const glm::vec3& direction,
+                         float max_distance);
+
+// Name of the instruction set used by intersect_nearest
+const char* ray_query_isa();
+
+#endif //SPACEOBJECTS_RAYQUERY_H
@@ -0,0 +1,226 @@
+#include "RenderCommands.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "OcclusionCulling.h"
+#include "ShaderPermutations.h"
+
+// True if the transformed box is completely behind one of the clip planes
+static bool outside_frustum(const BBox& bbox, const glm::mat4& transform) {
+    glm::vec4 corners[8];
+    for (int i = 0; i < 8; i++) {
+        const glm::vec3 corner(
+            (i & 1) ? bbox.max.x : bbox.min.x,
+            (i & 2) ? bbox.max.y : bbox.min.y,
+            (i & 4) ? bbox.max.z : bbox.min.z
+        );
+        corners[i] = transform * glm::vec4(corner, 1.0f);
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        bool below = true;
+        bool above = true;
+        for (const auto& corner : corners) {
+            below = below && corner[axis] < -corner.w;
+            above = above && corner[axis] > corner.w;
+        }
+        if (below || above) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CommandRecorder::init(WorkerPool* workers, FrameArena* arena) {
+    this->workers = workers;
+    this->arena = arena;
+
+    lists.resize(workers->size());
+    culled.resize(workers->size());
+    occluded.resize(workers->size());
+
+    GLint alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stride = (GLsizeiptr(sizeof(ObjectUniforms)) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &UBO);
+    GL_CHECK_ERRORS;
+}
+
+void CommandRecorder::record_item(const SceneItem& item, const Views& views, int worker) {
+    const auto& model = *item.model;
+
+    for (size_t pass = 0; pass < size_t(RenderPass::COUNT); pass++) {
+        const auto& view = RenderPass(pass) == RenderPass::SHADOW ? views.light : views.camera;
+        const auto model_transform = view * item.world;
+
+        if (outside_frustum(model.bbox, model_transform)) {
+            culled[worker][pass]++;
+            continue;
+        }
+
+        // Shadow casters hidden from the camera still cast visible shadows, so only the main pass is tested
+        if (RenderPass(pass) == RenderPass::MAIN && views.occlusion != nullptr
+            && views.occlusion->occluded(model.bbox, model_transform)) {
+            occluded[worker][pass]++;
+            continue;
+        }
+
+        // Sort by the depth of the model center, objects of a model are close to each other anyway
+        const auto center = model_transform * glm::vec4(0.5f * (model.bbox.min + model.bbox.max), 1.0f);
+        const float depth = glm::clamp(0.5f * center.z / center.w + 0.5f, 0.0f, 1.0f);
+        const auto depth_bits = uint64_t(depth * float(0xFFFFFF));
+
+        auto& list = lists[worker][pass];
+        for (const auto& object : model.objects) {
+            const auto& object_transform = object.getModelTransform();
+
+            ObjectUniforms uniforms;
+            uniforms.transform = model_transform * object_transform;
+            uniforms.world = item.world * object_transform;
+            uniforms.depth_transform = views.depth_matrix * item.world * object_transform;
+            uniforms.diffuse_color = object.getDiffuseColor();
+            uniforms.material = glm::vec4(object.getOpacity(), 0.0f, 0.0f, 0.0f);
+
+            DrawCommand command;
+            command.object = &object;
+            command.uniforms = uint32_t(list.uniforms.size());
+            command.state = 0;
+            command.features = (object.haveTexture() ? FEATURE_TEXTURE : 0u) | (object.alphaTest() ? FEATURE_ALPHA_TEST : 0u);
+
+            if (object.getOpacity() < 1.0f && RenderPass(pass) == RenderPass::MAIN) {
+                // Translucent objects go last, back to front
+                command.state |= DRAW_TRANSLUCENT;
+                command.key = (uint64_t(1) << 63) | (0xFFFFFF - depth_bits);
+            } else {
+                // Opaque ones are grouped by shader variant, then by texture, then front to back
+                command.key = (uint64_t(command.features & 0xFF) << 40)
+                            | (uint64_t(object.getTexture() & 0xFFFF) << 24) | depth_bits;
+            }
+
+            list.uniforms.push_back(uniforms);
+            list.draws.push_back(command);
+        }
+    }
+}
+
+void CommandRecorder::merge() {
+    size_t total = 0;
+    for (const auto& worker_lists : lists) {
+        for (const auto& list : worker_lists) {
+            total += list.uniforms.size();
+        }
+    }
+    staging = FrameVector<uint8_t>(*arena);
+    staging.resize(total * stride);
+
+    size_t base = 0;
+    for (size_t pass = 0; pass < size_t(RenderPass::COUNT); pass++) {
+        auto& merged = commands[pass];
+        merged = FrameVector<DrawCommand>(*arena);
+
+        // Grown storage isn't reused within the frame, size it up front
+        size_t count = 0;
+        for (const auto& worker_lists : lists) {
+            count += worker_lists[pass].draws.size();
+        }
+        merged.reserve(count);
+
+        stats.draws[pass] = 0;
+        stats.culled[pass] = 0;
+        stats.occluded[pass] = 0;
+
+        for (size_t worker = 0; worker < lists.size(); worker++) {
+            const auto& list = lists[worker][pass];
+
+            for (auto command : list.draws) {
+                command.uniforms += uint32_t(base);
+                merged.push_back(command);
+            }
+
+            for (size_t i = 0; i < list.uniforms.size(); i++) {
+                std::memcpy(staging.data() + (base + i) * stride, &list.uniforms[i], sizeof(ObjectUniforms));
+            }
+
+            base += list.uniforms.size();
+            stats.culled[pass] += culled[worker][pass];
+            stats.occluded[pass] += occluded[worker][pass];
+        }
+
+        std::sort(merged.begin(), merged.end(), [](const DrawCommand& first, const DrawCommand& second) {
+            return first.key < second.key;
+        });
+        stats.draws[pass] = merged.size();
+    }
+}
+
+void CommandRecorder::upload() {
+    glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+
+    const auto size = GLsizeiptr(staging.size());
+    if (size > ubo_size) {
+        ubo_size = size;
+    }
+    // Orphan the storage of the previous frame and fill the new one in a single call
+    glBufferData(GL_UNIFORM_BUFFER, ubo_size, nullptr, GL_STREAM_DRAW);
+    if (size > 0) {
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, size, staging.data());
+    }
+
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    GL_CHECK_ERRORS;
+}
+
+void CommandRecorder::record(const FrameVector<SceneItem>& scene, const Views& views) {
+    for (size_t worker = 0; worker < lists.size(); worker++) {
+        for (auto& list : lists[worker]) {
+            list.clear();
+        }
+        culled[worker].fill(0);
+        occluded[worker].fill(0);
+    }
+
+    workers->parallel_for(scene.size(), 4, [this, &scene, &views](size_t begin, size_t end, int worker) {
+        for (size_t i = begin; i < end; i++) {
+            record_item(scene[i], views, worker);
+        }
+    });
+
+    merge();
+    upload();
+}
+
+void CommandRecorder::replay(RenderPass pass, const BindProgram& bind_program, DrawSubset subset) const {
+    uint32_t state = 0;
+    uint32_t features = 0;
+    bool bound = false;
+
+    for (const auto& command : commands[size_t(pass)]) {
+        const bool translucent = (command.state & DRAW_TRANSLUCENT) != 0;
+        if ((subset == DrawSubset::OPAQUE && translucent) || (subset == DrawSubset::TRANSLUCENT && !translucent)) {
+            continue;
+        }
+        if (subset == DrawSubset::SOLID && (translucent || (command.features & FEATURE_ALPHA_TEST))) {
+            continue;
+        }
+
+        if (bind_program && (!bound || command.features != features)) {
+            bind_program(command.features);
+            features = command.features;
+            bound = true;
+        }
+
+        if (command.state != state) {
+            glDepthMask((command.state & DRAW_TRANSLUCENT) ? GL_FALSE : GL_TRUE);
+            state = command.state;
+        }
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, uniform_binding, UBO,
+                          GLintptr(command.uniforms) * stride, sizeof(ObjectUniforms));
+        command.object->draw();
+    }
+
+    glDepthMask(GL_TRUE);
+    glBindBufferBase(GL_UNIFORM_BUFFER, uniform_binding, 0);
+}
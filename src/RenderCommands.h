@@ -0,0 +1,141 @@
+#ifndef SPACEOBJECTS_RENDERCOMMANDS_H
+#define SPACEOBJECTS_RENDERCOMMANDS_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "common.h"
+#include "FrameArena.h"
+#include "Model.h"
+#include "WorkerPool.h"
+
+class OcclusionCuller;
+
+enum class RenderPass {
+    SHADOW,
+    MAIN,
+    COUNT
+};
+
+// Per draw data, mirrors ObjectBlock (std140) in the object shaders
+struct ObjectUniforms {
+    glm::mat4 transform;
+    glm::mat4 world;
+    glm::mat4 depth_transform;
+    glm::vec4 diffuse_color;
+    glm::vec4 material;  // x - opacity
+};
+
+struct DrawCommand {
+    uint64_t key;            // Sort key, commands are replayed in ascending order
+    const Object* object;
+    uint32_t uniforms;       // Index of the uniform block slot
+    uint32_t state;
+    uint32_t features;       // Shader variant of the object, see ShaderFeature
+};
+
+// Render state bits of a draw command
+enum DrawState : uint32_t {
+    DRAW_TRANSLUCENT = 1u << 0,
+};
+
+// Which draws of a pass to replay
+enum class DrawSubset {
+    ALL,
+    OPAQUE,
+    SOLID,        // Opaque without alpha testing, their depth is known without shading
+    TRANSLUCENT
+};
+
+// Immutable view of the scene used for recording
+struct SceneItem {
+    glm::mat4 world;
+    const Model* model;
+};
+
+struct CommandList {
+    std::vector<DrawCommand> draws;
+    std::vector<ObjectUniforms> uniforms;
+
+    void clear() {
+        draws.clear();
+        uniforms.clear();
+    }
+};
+
+// Builds the draw commands of every pass on the worker threads:
+// culling, sort keys and uniform packing happen in parallel from a scene snapshot,
+// then the per-worker lists are merged, the uniforms of the whole frame are uploaded
+// into one uniform buffer and the GL thread replays the sorted commands.
+class CommandRecorder {
+public:
+    struct Views {
+        glm::mat4 camera;        // View projection of the main pass
+        glm::mat4 light;         // View projection of the shadow pass
+        glm::mat4 depth_matrix;  // Light space lookup of the shadow map
+
+        const OcclusionCuller* occlusion = nullptr;  // Tests models of the main pass if set
+    };
+
+    struct Stats {
+        size_t draws[size_t(RenderPass::COUNT)];
+        size_t culled[size_t(RenderPass::COUNT)];    // Models outside of the frustum
+        size_t occluded[size_t(RenderPass::COUNT)];  // Models hidden by occluders
+    };
+
+    static constexpr GLuint uniform_binding = 0;
+
+private:
+    WorkerPool* workers = nullptr;
+    FrameArena* arena = nullptr;
+
+    // [pass][worker]
+    std::vector<std::array<CommandList, size_t(RenderPass::COUNT)>> lists;
+    std::vector<std::array<size_t, size_t(RenderPass::COUNT)>> culled;
+    std::vector<std::array<size_t, size_t(RenderPass::COUNT)>> occluded;
+
+    // Merged result, in the frame arena
+    std::array<FrameVector<DrawCommand>, size_t(RenderPass::COUNT)> commands;
+    FrameVector<uint8_t> staging;
+
+    GLuint UBO = 0;
+    GLsizeiptr ubo_size = 0;
+    GLsizeiptr stride = 0;
+
+    Stats stats;
+
+    void record_item(const SceneItem& item, const Views& views, int worker);
+
+    void merge();
+
+    void upload();
+
+public:
+    CommandRecorder() = default;
+
+    // The merged commands are kept in the arena until it starts the frame after the next one
+    void init(WorkerPool* workers, FrameArena* arena);
+
+    // Record all passes for the given scene snapshot, must be called on the GL thread
+    void record(const FrameVector<SceneItem>& scene, const Views& views);
+
+    // Called before the first draw and whenever the shader features of the draws change
+    typedef std::function<void(uint32_t features)> BindProgram;
+
+    // Issue the draws of a pass. The caller binds the program and sets per-pass uniforms,
+    // either up front or in bind_program when the pass uses shader variants.
+    // The depth mask is only switched between opaque and translucent draws, bind_program may set it
+    // for the opaque ones. It is enabled again at the end
+    void replay(RenderPass pass, const BindProgram& bind_program = BindProgram(),
+                DrawSubset subset = DrawSubset::ALL) const;
+
+    const Stats& get_stats() const {
+        return stats;
+    }
+};
+
+#endif //SPACEOBJECTS_RENDERCOMMANDS_H
@@ -0,0 +1,140 @@
+#ifndef SPACEOBJECTS_SCENESTATE_H
+#define SPACEOBJECTS_SCENESTATE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Model.h"
+#include "Allocations.h"
+#include "FrameArena.h"
+
+// Lock free exchange of the latest state between one writer and one reader thread.
+// The writer fills its own slot and publishes it, the reader always gets the most
+// recent published slot. Neither side ever waits for the other, intermediate states
+// the reader was too slow to see are dropped.
+template<typename T>
+class TripleBuffer {
+    static constexpr unsigned index_mask = 3;
+    static constexpr unsigned fresh_bit = 4;  // Set when the middle slot hasn't been read yet
+
+    T slots[3];
+    std::atomic<unsigned> middle;
+    unsigned back = 1;   // Owned by the writer
+    unsigned front = 2;  // Owned by the reader
+
+public:
+    TripleBuffer() : middle(0) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Slot to fill by the writer, its previous content is some older state
+    T& write_buffer() {
+        return slots[back];
+    }
+
+    void publish() {
+        back = middle.exchange(back | fresh_bit, std::memory_order_acq_rel) & index_mask;
+    }
+
+    // Latest published state, stays valid until the next call on the reader thread
+    const T& read() {
+        if (middle.load(std::memory_order_relaxed) & fresh_bit) {
+            front = middle.exchange(front, std::memory_order_acq_rel) & index_mask;
+        }
+        return slots[front];
+    }
+};
+
+// Bounded single producer, single consumer queue for one-off events
+template<typename T, size_t N>
+class EventQueue {
+    T events[N];
+    std::atomic<size_t> head;  // Next event to pop, written by the consumer
+    std::atomic<size_t> tail;  // Next free slot, written by the producer
+
+public:
+    EventQueue() : head(0), tail(0) {}
+
+    EventQueue(const EventQueue&) = delete;
+    EventQueue& operator=(const EventQueue&) = delete;
+
+    // Returns false if the queue is full
+    bool push(const T& event) {
+        const size_t position = tail.load(std::memory_order_relaxed);
+        if (position - head.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+
+        events[position % N] = event;
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& event) {
+        const size_t position = head.load(std::memory_order_relaxed);
+        if (position == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        event = events[position % N];
+        head.store(position + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Transform of a model at the last two simulation steps
+struct ModelState {
+    glm::vec3 prev_position;
+    glm::vec3 position;
+    glm::mat4 orientation;  // Rotation and scale
+    const Model* model;     // Only the meshes and the local bounding box may be used by the reader
+
+    glm::mat4 getWorldTransform(float alpha) const {
+        return glm::translate(glm::mat4(1.0f), glm::mix(prev_position, position, alpha)) * orientation;
+    }
+};
+
+// Particle burst requested by the simulation and spawned by the renderer
+struct BurstEvent {
+    glm::vec3 position;
+    int amount;
+    glm::vec4 color;
+    float speed;
+    float lifetime;
+    float duration;
+};
+
+// Everything the renderer needs from one simulation step
+struct SceneSnapshot {
+    double time = 0.0;  // Wall clock time of the step
+
+    std::vector<ModelState> models;  // Visible models only
+
+    glm::mat4 camera_prev_world;  // Of the camera node, the view is its inverse
+    glm::mat4 camera_world;
+    glm::vec3 camera_position;
+    glm::vec3 camera_shift;
+
+    glm::vec3 particles_state;
+    glm::vec3 enemies_speed;
+
+    glm::vec3 thruster_position;
+
+    const char* broadphase = "";  // Name of the backend
+    size_t collision_pairs = 0;
+    float main_ship_hp = 0.0f;
+
+    size_t entities = 0;
+    AllocationCount step_allocations;  // Heap allocations of the last simulation step
+    FrameArena::Stats step_arena;
+
+    bool laser_visible = false;
+    glm::vec3 laser_src;
+    glm::vec3 laser_dst;
+};
+
+#endif //SPACEOBJECTS_SCENESTATE_H
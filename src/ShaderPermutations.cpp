@@ -0,0 +1,51 @@
+#include "ShaderPermutations.h"
+
+ShaderPermutations::ShaderPermutations(const std::unordered_map<GLenum, std::string>& shaders, const Setup& setup) :
+    shaders(shaders),
+    setup(setup) {}
+
+std::vector<std::string> ShaderPermutations::get_defines(uint32_t key) {
+    std::vector<std::string> defines;
+
+    if (key & FEATURE_TEXTURE) {
+        defines.emplace_back("HAS_TEXTURE");
+    }
+    if (key & FEATURE_ALPHA_TEST) {
+        defines.emplace_back("ALPHA_TEST");
+    }
+    if (key & FEATURE_CLUSTERED_LIGHTS) {
+        defines.emplace_back("CLUSTERED_LIGHTS");
+    }
+    defines.push_back("SHADOW_TIER " + std::to_string((key & FEATURE_SHADOW_MASK) >> 2));
+
+    return defines;
+}
+
+ShaderProgram& ShaderPermutations::build(uint32_t key) {
+    auto& program = programs[key];
+    program = ShaderProgram(shaders, std::vector<std::string>(), get_defines(key));
+    GL_CHECK_ERRORS;
+
+    if (setup) {
+        setup(program, key);
+    }
+    return program;
+}
+
+void ShaderPermutations::compile() {
+    for (const auto key : requested) {
+        if (programs.find(key) == programs.end()) {
+            build(key);
+        }
+    }
+}
+
+const ShaderProgram& ShaderPermutations::get(uint32_t key) {
+    const auto it = programs.find(key);
+    if (it != programs.end()) {
+        return it->second;
+    }
+
+    requested.insert(key);
+    return build(key);
+}
@@ -0,0 +1,61 @@
+#ifndef SPACEOBJECTS_SHADERPERMUTATIONS_H
+#define SPACEOBJECTS_SHADERPERMUTATIONS_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ShaderProgram.h"
+
+// Feature bits of a shader variant, every combination is a separately compiled program
+enum ShaderFeature : uint32_t {
+    FEATURE_TEXTURE = 1u << 0,      // HAS_TEXTURE
+    FEATURE_ALPHA_TEST = 1u << 1,   // ALPHA_TEST
+    FEATURE_SHADOW_LOW = 1u << 2,   // SHADOW_TIER 1, single tap
+    FEATURE_SHADOW_HIGH = 2u << 2,  // SHADOW_TIER 2, 4 tap Poisson
+    FEATURE_SHADOW_MASK = 3u << 2,
+    FEATURE_CLUSTERED_LIGHTS = 1u << 4,  // CLUSTERED_LIGHTS, point lights from LightClusters
+};
+
+// Variants of one shader specialized at compile time with defines.
+// Only the requested keys are compiled up front, the rest is compiled on first use.
+class ShaderPermutations {
+public:
+    // Called once for every compiled variant, e.g. to bind uniform blocks and sampler units
+    typedef std::function<void(ShaderProgram& program, uint32_t key)> Setup;
+
+private:
+    std::unordered_map<GLenum, std::string> shaders;
+    Setup setup;
+
+    std::map<uint32_t, ShaderProgram> programs;
+    std::set<uint32_t> requested;
+
+    ShaderProgram& build(uint32_t key);
+
+public:
+    ShaderPermutations() = default;
+
+    ShaderPermutations(const std::unordered_map<GLenum, std::string>& shaders, const Setup& setup);
+
+    static std::vector<std::string> get_defines(uint32_t key);
+
+    void request(uint32_t key) {
+        requested.insert(key);
+    }
+
+    // Compile the requested variants which are not built yet
+    void compile();
+
+    const ShaderProgram& get(uint32_t key);
+
+    size_t size() const {
+        return programs.size();
+    }
+};
+
+#endif //SPACEOBJECTS_SHADERPERMUTATIONS_H
@@ -1,44 +1,54 @@
 #include "ShaderProgram.h"
 
-ShaderProgram::ShaderProgram(const std::unordered_map<GLenum, std::string> &inputShaders)
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+ShaderProgram::ShaderProgram(const std::unordered_map<GLenum, std::string> &inputShaders) :
+  ShaderProgram(inputShaders, std::vector<std::string>())
+{
+}
+
+ShaderProgram::ShaderProgram(const std::unordered_map<GLenum, std::string> &inputShaders,
+                             const std::vector<std::string> &feedbackVaryings,
+                             const std::vector<std::string> &defines)
 {
 
   shaderProgram = glCreateProgram();
 
-  if (inputShaders.find(GL_VERTEX_SHADER) != inputShaders.end())
-  {
-    shaderObjects[GL_VERTEX_SHADER] = LoadShaderObject(GL_VERTEX_SHADER, inputShaders.at(GL_VERTEX_SHADER));
-    glAttachShader(shaderProgram, shaderObjects[GL_VERTEX_SHADER]);
-  }
+  // Ordered by stage, so that the cache key doesn't depend on the order of the input
+  std::map<GLenum, std::string> sources;
+  for (const auto &input : inputShaders)
+    sources[input.first] = InjectDefines(ReadShaderSource(input.second), defines);
 
-  if (inputShaders.find(GL_FRAGMENT_SHADER) != inputShaders.end())
-  {
-    shaderObjects[GL_FRAGMENT_SHADER] = LoadShaderObject(GL_FRAGMENT_SHADER, inputShaders.at(GL_FRAGMENT_SHADER));
-    glAttachShader(shaderProgram, shaderObjects[GL_FRAGMENT_SHADER]);
-  }
-  if (inputShaders.find(GL_GEOMETRY_SHADER) != inputShaders.end())
-  {
-    shaderObjects[GL_GEOMETRY_SHADER] = LoadShaderObject(GL_GEOMETRY_SHADER, inputShaders.at(GL_GEOMETRY_SHADER));
-    glAttachShader(shaderProgram, shaderObjects[GL_GEOMETRY_SHADER]);
-  }
-  if (inputShaders.find(GL_TESS_CONTROL_SHADER) != inputShaders.end())
-  {
-    shaderObjects[GL_TESS_CONTROL_SHADER] = LoadShaderObject(GL_TESS_CONTROL_SHADER,
-      inputShaders.at(GL_TESS_CONTROL_SHADER));
-    glAttachShader(shaderProgram, shaderObjects[GL_TESS_CONTROL_SHADER]);
-  }
-  if (inputShaders.find(GL_TESS_EVALUATION_SHADER) != inputShaders.end())
+  const std::string cachePath = BinaryCachePath(sources, feedbackVaryings);
+  if (!cachePath.empty() && LoadBinary(cachePath))
+    return;
+
+  for (const auto &source : sources)
   {
-    shaderObjects[GL_TESS_EVALUATION_SHADER] = LoadShaderObject(GL_TESS_EVALUATION_SHADER,
-      inputShaders.at(GL_TESS_EVALUATION_SHADER));
-    glAttachShader(shaderProgram, shaderObjects[GL_TESS_EVALUATION_SHADER]);
+    shaderObjects[source.first] = LoadShaderObject(source.first, source.second);
+    glAttachShader(shaderProgram, shaderObjects[source.first]);
   }
-  if (inputShaders.find(GL_COMPUTE_SHADER) != inputShaders.end())
+
+  if (!feedbackVaryings.empty())
   {
-    shaderObjects[GL_COMPUTE_SHADER] = LoadShaderObject(GL_COMPUTE_SHADER, inputShaders.at(GL_COMPUTE_SHADER));
-    glAttachShader(shaderProgram, shaderObjects[GL_COMPUTE_SHADER]);
+    std::vector<const GLchar *> varyings;
+    for (const auto &name : feedbackVaryings)
+      varyings.push_back(name.c_str());
+
+    glTransformFeedbackVaryings(shaderProgram, GLsizei(varyings.size()), varyings.data(), GL_INTERLEAVED_ATTRIBS);
   }
 
+  if (!cachePath.empty())
+    glProgramParameteri(shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
   glLinkProgram(shaderProgram);
 
   GLint linkStatus;
@@ -51,8 +61,11 @@ ShaderProgram::ShaderProgram(const std::unordered_map<GLenum, std::string> &inpu
     glGetProgramInfoLog(shaderProgram, 512, nullptr, infoLog);
     std::cerr << "Shader program linking failed\n" << infoLog << std::endl;
     shaderProgram = 0;
+    return;
   }
 
+  if (!cachePath.empty())
+    SaveBinary(cachePath);
 }
 
 
@@ -122,21 +135,67 @@ bool ShaderProgram::reLink()
 }
 
 
-GLuint ShaderProgram::LoadShaderObject(GLenum type, const std::string &filename)
+std::string ShaderProgram::ReadShaderSource(const std::string &filename, int depth)
 {
   std::ifstream fs(filename);
 
   if (!fs.is_open())
   {
     std::cerr << "ERROR: Could not read shader from " << filename << std::endl;
-    return 0;
+    return std::string();
+  }
+
+  if (depth > 8)
+  {
+    std::cerr << "ERROR: Includes are nested too deep in " << filename << std::endl;
+    return std::string();
+  }
+
+  const auto slash = filename.find_last_of('/');
+  const std::string directory = slash == std::string::npos ? std::string() : filename.substr(0, slash + 1);
+
+  std::string source;
+  std::string line;
+  while (std::getline(fs, line))
+  {
+    const auto open = line.find('"');
+    const auto close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+    if (line.compare(0, 8, "#include") == 0 && close != std::string::npos)
+      source += ReadShaderSource(directory + line.substr(open + 1, close - open - 1), depth + 1);
+    else
+      source += line;
+    source += '\n';
   }
 
-  std::string shaderText((std::istreambuf_iterator<char>(fs)), std::istreambuf_iterator<char>());
+  return source;
+}
+
+std::string ShaderProgram::InjectDefines(const std::string &source, const std::vector<std::string> &defines)
+{
+  if (defines.empty())
+    return source;
+
+  std::string block;
+  for (const auto &define : defines)
+    block += "#define " + define + "\n";
+
+  // #version has to stay the first statement of the shader
+  const auto version = source.find("#version");
+  if (version == std::string::npos)
+    return block + source;
 
+  const auto lineEnd = source.find('\n', version);
+  if (lineEnd == std::string::npos)
+    return source + "\n" + block;
+
+  return source.substr(0, lineEnd + 1) + block + source.substr(lineEnd + 1);
+}
+
+GLuint ShaderProgram::LoadShaderObject(GLenum type, const std::string &source)
+{
   GLuint newShaderObject = glCreateShader(type);
 
-  const char *shaderSrc = shaderText.c_str();
+  const char *shaderSrc = source.c_str();
   glShaderSource(newShaderObject, 1, &shaderSrc, nullptr);
 
   glCompileShader(newShaderObject);
@@ -155,6 +214,145 @@ GLuint ShaderProgram::LoadShaderObject(GLenum type, const std::string &filename)
   return newShaderObject;
 }
 
+std::string ShaderProgram::binaryCacheDirectory;
+
+// Written in front of every cached binary, bump the version when the layout changes
+static const uint32_t binaryCacheMagic = 0x53504231; // "SPB1"
+
+void ShaderProgram::EnableBinaryCache(const std::string &directory)
+{
+  GLint formats = 0;
+  if (GLAD_GL_VERSION_4_1)
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+
+  if (formats == 0)
+  {
+    std::cerr << "Program binaries are not supported, shaders will be compiled on every launch" << std::endl;
+    return;
+  }
+
+#ifdef _WIN32
+  _mkdir(directory.c_str());
+#else
+  mkdir(directory.c_str(), 0755);
+#endif
+
+  binaryCacheDirectory = directory;
+}
+
+std::string ShaderProgram::BinaryCachePath(const std::map<GLenum, std::string> &sources,
+                                           const std::vector<std::string> &feedbackVaryings)
+{
+  if (binaryCacheDirectory.empty())
+    return std::string();
+
+  // 64-bit FNV-1a over everything the linked program depends on
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const auto feed = [&hash](const void *data, size_t size)
+  {
+    const auto bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 0x100000001b3ull;
+    }
+    // Separator, so that different splits of the same bytes give different keys
+    hash ^= 0xff;
+    hash *= 0x100000001b3ull;
+  };
+
+  for (const auto name : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION})
+  {
+    const auto value = reinterpret_cast<const char *>(glGetString(name));
+    if (value != nullptr)
+      feed(value, std::strlen(value));
+  }
+
+  for (const auto &source : sources)
+  {
+    feed(&source.first, sizeof(source.first));
+    feed(source.second.data(), source.second.size());
+  }
+
+  for (const auto &varying : feedbackVaryings)
+    feed(varying.data(), varying.size());
+
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(hash));
+  return binaryCacheDirectory + "/" + name;
+}
+
+bool ShaderProgram::LoadBinary(const std::string &path)
+{
+  std::ifstream fs(path, std::ios::binary);
+  if (!fs.is_open())
+    return false;
+
+  uint32_t magic = 0;
+  GLenum format = 0;
+  uint32_t length = 0;
+  fs.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+  fs.read(reinterpret_cast<char *>(&format), sizeof(format));
+  fs.read(reinterpret_cast<char *>(&length), sizeof(length));
+  if (!fs || magic != binaryCacheMagic || length == 0)
+    return false;
+
+  std::vector<char> binary(length);
+  if (!fs.read(binary.data(), length))
+    return false;
+
+  glProgramBinary(shaderProgram, format, binary.data(), GLsizei(length));
+
+  // Drivers reject binaries after an update or for another GPU, then the program is built from source
+  GLint linkStatus;
+  glGetProgramiv(shaderProgram, GL_LINK_STATUS, &linkStatus);
+  if (linkStatus != GL_TRUE)
+  {
+    std::cerr << "Cached program " << path << " was rejected, compiling from source" << std::endl;
+    glDeleteProgram(shaderProgram);
+    shaderProgram = glCreateProgram();
+    return false;
+  }
+
+  return true;
+}
+
+void ShaderProgram::SaveBinary(const std::string &path) const
+{
+  GLint length = 0;
+  glGetProgramiv(shaderProgram, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  glGetProgramBinary(shaderProgram, length, nullptr, &format, binary.data());
+
+  std::ofstream fs(path, std::ios::binary | std::ios::trunc);
+  if (!fs.is_open())
+  {
+    std::cerr << "Could not write program binary to " << path << std::endl;
+    return;
+  }
+
+  const auto size = uint32_t(length);
+  fs.write(reinterpret_cast<const char *>(&binaryCacheMagic), sizeof(binaryCacheMagic));
+  fs.write(reinterpret_cast<const char *>(&format), sizeof(format));
+  fs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  fs.write(binary.data(), length);
+}
+
+void ShaderProgram::BindUniformBlock(const std::string &name, GLuint binding) const
+{
+  GLuint blockIndex = glGetUniformBlockIndex(shaderProgram, name.c_str());
+  if (blockIndex == GL_INVALID_INDEX)
+  {
+    std::cerr << "Uniform block " << name << " not found" << std::endl;
+    return;
+  }
+  glUniformBlockBinding(shaderProgram, blockIndex, binding);
+}
+
 void ShaderProgram::StartUseShader() const
 {
   glUseProgram(shaderProgram);
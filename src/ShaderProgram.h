@@ -1,7 +1,9 @@
 #ifndef SHADERPROGRAM_H
 #define SHADERPROGRAM_H
 
+#include <map>
 #include <unordered_map>
+#include <vector>
 #include "common.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -15,6 +17,12 @@ public:
 
   ShaderProgram(const std::unordered_map<GLenum, std::string> &inputShaders);
 
+  // Variables captured with transform feedback must be declared before linking.
+  // Defines ("NAME" or "NAME VALUE") are inserted into every stage right after #version
+  ShaderProgram(const std::unordered_map<GLenum, std::string> &inputShaders,
+                const std::vector<std::string> &feedbackVaryings,
+                const std::vector<std::string> &defines = std::vector<std::string>());
+
   virtual ~ShaderProgram() {};
 
   void Release(); //actual destructor
@@ -28,6 +36,8 @@ public:
 
   bool reLink();
 
+  void BindUniformBlock(const std::string &name, GLuint binding) const;
+
   void SetUniform(const std::string &location, float value) const;
 
   void SetUniform(const std::string &location, double value) const;
@@ -44,9 +54,27 @@ public:
 
   void SetUniform(const std::string &location, const glm::vec4& v4) const;
 
+  // Store linked programs in the directory and load them instead of compiling on the next launches.
+  // Binaries are keyed by the shader sources and the driver, a rejected binary is compiled from source
+  static void EnableBinaryCache(const std::string &directory);
+
 
 private:
-  static GLuint LoadShaderObject(GLenum type, const std::string &filename);
+  // Reads the file with its #include "path" lines replaced by the files, relative to the including one
+  static std::string ReadShaderSource(const std::string &filename, int depth = 0);
+
+  static std::string InjectDefines(const std::string &source, const std::vector<std::string> &defines);
+
+  static GLuint LoadShaderObject(GLenum type, const std::string &source);
+
+  static std::string BinaryCachePath(const std::map<GLenum, std::string> &sources,
+                                     const std::vector<std::string> &feedbackVaryings);
+
+  bool LoadBinary(const std::string &path);
+
+  void SaveBinary(const std::string &path) const;
+
+  static std::string binaryCacheDirectory;
 
   GLuint shaderProgram;
   std::unordered_map<GLenum, GLuint> shaderObjects;
@@ -4,9 +4,10 @@
 #include <glm/glm.hpp>
 #include "common.h"
 
+// Depth texture itself is a transient frame graph resource,
+// the shadow map holds the light transform and the comparison sampler
 class ShadowMap {
-    GLuint FramebufferName;
-    GLuint depthTexture;
+    GLuint sampler;
 public:
     int width, height;
 
@@ -15,7 +16,8 @@ public:
     int init(int width, int height);
     void activate();
     void deactivate();
-    void bind();
+    void bind(GLuint depth_texture);
+    void unbind();
 };
 
 #endif //SHADOWMAP_H
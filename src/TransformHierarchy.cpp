@@ -0,0 +1,194 @@
+#include "TransformHierarchy.h"
+
+// Bound to references by the containers
+constexpr TransformHierarchy::Node TransformHierarchy::none;
+
+void TransformHierarchy::reserve(size_t count) {
+    parents.reserve(count);
+    locals.reserve(count);
+    worlds.reserve(count);
+    dirty.reserve(count);
+    changed.reserve(count);
+    alive.reserve(count);
+    free_nodes.reserve(count);
+    first_child.reserve(count);
+    next_sibling.reserve(count);
+    previous_sibling.reserve(count);
+    order.reserve(count);
+    positions.reserve(count);
+}
+
+void TransformHierarchy::link(Node child, Node parent) {
+    parents[child] = parent;
+    previous_sibling[child] = none;
+    next_sibling[child] = none;
+    if (parent == none) {
+        return;
+    }
+
+    next_sibling[child] = first_child[parent];
+    if (first_child[parent] != none) {
+        previous_sibling[first_child[parent]] = child;
+    }
+    first_child[parent] = child;
+}
+
+void TransformHierarchy::unlink(Node child) {
+    const Node parent = parents[child];
+    if (parent == none) {
+        return;
+    }
+
+    if (previous_sibling[child] != none) {
+        next_sibling[previous_sibling[child]] = next_sibling[child];
+    } else {
+        first_child[parent] = next_sibling[child];
+    }
+    if (next_sibling[child] != none) {
+        previous_sibling[next_sibling[child]] = previous_sibling[child];
+    }
+    parents[child] = none;
+}
+
+TransformHierarchy::Node TransformHierarchy::create(const glm::mat4& local, Node parent) {
+    // Close the holes rather than grow the order past what was reserved
+    if (order.size() == order.capacity() && holes > 0) {
+        compact();
+    }
+
+    Node node;
+    if (!free_nodes.empty()) {
+        node = free_nodes.back();
+        free_nodes.pop_back();
+    } else {
+        node = Node(parents.size());
+        parents.push_back(none);
+        locals.emplace_back(1.0f);
+        worlds.emplace_back(1.0f);
+        dirty.push_back(0);
+        changed.push_back(0);
+        alive.push_back(0);
+        first_child.push_back(none);
+        next_sibling.push_back(none);
+        previous_sibling.push_back(none);
+        positions.push_back(none);
+    }
+
+    link(node, parent);
+    locals[node] = local;
+    worlds[node] = local;
+    dirty[node] = 1;
+    changed[node] = 0;
+    alive[node] = 1;
+
+    // A new node has no children, so any place after its parent is valid: the hole it left behind,
+    // or the end of the order
+    const uint32_t position = positions[node];
+    if (position != none && (parent == none || positions[parent] < position)) {
+        order[position] = node;
+        holes--;
+    } else {
+        // A hole left behind stays until the next compaction
+        positions[node] = uint32_t(order.size());
+        order.push_back(node);
+    }
+    stats.nodes++;
+    return node;
+}
+
+void TransformHierarchy::destroy(Node node) {
+    for (Node child = first_child[node]; child != none;) {
+        const Node next = next_sibling[child];
+
+        // Roots may come anywhere in the order, the children stay where they are
+        locals[child] = worlds[child];
+        link(child, none);
+        dirty[child] = 1;
+        child = next;
+    }
+    first_child[node] = none;
+    unlink(node);
+
+    order[positions[node]] = none;
+    holes++;
+
+    alive[node] = 0;
+    free_nodes.push_back(node);
+    stats.nodes--;
+}
+
+void TransformHierarchy::attach(Node child, Node parent) {
+    unlink(child);
+    link(child, parent);
+    dirty[child] = 1;
+
+    // The subtree of the child follows it, so only a parent later in the order needs a new one
+    if (parent != none && positions[parent] > positions[child]) {
+        order_dirty = true;
+    }
+}
+
+void TransformHierarchy::sort() {
+    // Breadth first from the roots
+    order.clear();
+    for (Node node = 0; node < parents.size(); node++) {
+        if (alive[node] && parents[node] == none) {
+            order.push_back(node);
+        }
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        for (Node child = first_child[order[i]]; child != none; child = next_sibling[child]) {
+            order.push_back(child);
+        }
+    }
+
+    for (Node node = 0; node < parents.size(); node++) {
+        positions[node] = none;
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+        positions[order[i]] = uint32_t(i);
+    }
+
+    holes = 0;
+    order_dirty = false;
+}
+
+void TransformHierarchy::compact() {
+    size_t kept = 0;
+    for (size_t i = 0; i < order.size(); i++) {
+        const Node node = order[i];
+        if (node != none) {
+            order[kept] = node;
+            positions[node] = uint32_t(kept);
+            kept++;
+        }
+    }
+    order.resize(kept);
+
+    for (const Node node : free_nodes) {
+        positions[node] = none;
+    }
+    holes = 0;
+}
+
+void TransformHierarchy::update() {
+    if (order_dirty) {
+        sort();
+    } else if (holes > order.size() / 2) {
+        compact();
+    }
+
+    stats.updated = 0;
+    for (const Node node : order) {
+        if (node == none) continue;
+
+        const Node parent = parents[node];
+        // Parents come first, so their flag already says whether the world above changed
+        changed[node] = dirty[node] || (parent != none && changed[parent]);
+        if (!changed[node]) continue;
+
+        worlds[node] = parent == none ? locals[node] : worlds[parent] * locals[node];
+        dirty[node] = 0;
+        stats.updated++;
+    }
+}
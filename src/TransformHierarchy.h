@@ -0,0 +1,98 @@
+#ifndef SPACEOBJECTS_TRANSFORMHIERARCHY_H
+#define SPACEOBJECTS_TRANSFORMHIERARCHY_H
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Parent-child transforms of the scene.
+// Local and world matrices live in contiguous arrays indexed by stable node handles.
+// Setting a local transform marks the node dirty, update() walks the nodes with parents
+// before children and recomputes the world matrices of the dirty subtrees only.
+// Creating and destroying nodes keeps the walk order valid, so it doesn't cost a full sort.
+class TransformHierarchy {
+public:
+    typedef uint32_t Node;
+    static constexpr Node none = UINT32_MAX;
+
+    struct Stats {
+        size_t nodes = 0;
+        size_t updated = 0;  // World matrices recomputed by the last update
+    };
+
+private:
+    std::vector<Node> parents;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> dirty;    // Local changed since the last update
+    std::vector<uint8_t> changed;  // World recomputed by the last update
+    std::vector<uint8_t> alive;
+    std::vector<Node> free_nodes;
+
+    // Children of every node in a doubly linked list, so removing one doesn't search
+    std::vector<Node> first_child;
+    std::vector<Node> next_sibling;
+    std::vector<Node> previous_sibling;
+
+    // Topological, parents before their children. Destroyed nodes leave `none` holes behind,
+    // which are refilled when their slot is reused in a valid place and compacted once they pile up
+    std::vector<Node> order;
+    std::vector<uint32_t> positions;  // In the order, `none` for nodes without an entry
+    size_t holes = 0;
+    bool order_dirty = false;         // Only set by attaching to a parent which comes later
+
+    Stats stats;
+
+    void link(Node child, Node parent);
+
+    void unlink(Node child);
+
+    void sort();
+
+    void compact();
+
+public:
+    TransformHierarchy() = default;
+
+    // Up to `count` nodes can be created and destroyed without allocating
+    void reserve(size_t count);
+
+    Node create(const glm::mat4& local = glm::mat4(1.0f), Node parent = none);
+
+    // Children of the node are detached and keep their world transform as the local one
+    void destroy(Node node);
+
+    // The local transform stays, so the child moves along with its new parent. `none` detaches
+    void attach(Node child, Node parent);
+
+    void set_local(Node node, const glm::mat4& local) {
+        locals[node] = local;
+        dirty[node] = 1;
+    }
+
+    const glm::mat4& get_local(Node node) const {
+        return locals[node];
+    }
+
+    // Valid after update()
+    const glm::mat4& get_world(Node node) const {
+        return worlds[node];
+    }
+
+    Node get_parent(Node node) const {
+        return parents[node];
+    }
+
+    // True if the world transform was recomputed by the last update
+    bool was_changed(Node node) const {
+        return changed[node] != 0;
+    }
+
+    void update();
+
+    const Stats& get_stats() const {
+        return stats;
+    }
+};
+
+#endif //SPACEOBJECTS_TRANSFORMHIERARCHY_H
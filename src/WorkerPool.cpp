@@ -0,0 +1,273 @@
+#include "WorkerPool.h"
+
+#include <algorithm>
+
+// Pool and index of the worker on its own threads
+static thread_local const WorkerPool* worker_pool = nullptr;
+static thread_local int worker_index = -1;
+
+void WorkerPool::Queue::push(Pending&& pending) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tail - head == ring.size()) {
+        std::vector<Pending> grown(std::max<size_t>(2 * ring.size(), 64));
+        for (size_t i = head; i < tail; i++) {
+            grown[i & (grown.size() - 1)] = std::move(ring[i & (ring.size() - 1)]);
+        }
+        ring.swap(grown);
+    }
+    ring[tail++ & (ring.size() - 1)] = std::move(pending);
+}
+
+bool WorkerPool::Queue::pop(Pending& pending) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (head == tail) {
+        return false;
+    }
+    pending = std::move(ring[--tail & (ring.size() - 1)]);
+    return true;
+}
+
+bool WorkerPool::Queue::steal(Pending& pending) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (head == tail) {
+        return false;
+    }
+    pending = std::move(ring[head++ & (ring.size() - 1)]);
+    return true;
+}
+
+WorkerPool::WorkerPool(int nb_threads) : main_thread(std::this_thread::get_id()), queued(0), main_queued(0), sleeping(0) {
+    if (nb_threads < 0) {
+        // At least one, so threads outside of the pool have a worker to run their jobs
+        nb_threads = std::max(int(std::thread::hardware_concurrency()) - 1, 1);
+    }
+
+    for (int i = 0; i <= nb_threads; i++) {
+        queues.emplace_back(new Queue());
+    }
+    for (int i = 0; i < nb_threads; i++) {
+        threads.emplace_back(&WorkerPool::work, this, i + 1);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    wake.notify_all();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+int WorkerPool::current_worker() const {
+    if (worker_pool == this) {
+        return worker_index;
+    }
+    return std::this_thread::get_id() == main_thread ? 0 : -1;
+}
+
+void WorkerPool::notify_sleeping(bool all) {
+    if (sleeping.load() == 0) {
+        return;
+    }
+
+    // Taking the mutex orders the notification after the check of a thread going to sleep
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+    }
+    if (all) {
+        wake.notify_all();
+        finished.notify_all();
+    } else {
+        wake.notify_one();
+    }
+}
+
+void WorkerPool::enqueue(Pending&& pending, int worker) {
+    if (pending.main) {
+        main_jobs.push(std::move(pending));
+        main_queued++;
+        // Only the main thread can take it, any other one might get a single notification
+        notify_sleeping(true);
+        return;
+    }
+
+    if (threads.empty()) {
+        execute(pending, std::max(worker, 0));
+        return;
+    }
+
+    (worker >= 0 ? *queues[worker] : shared).push(std::move(pending));
+    queued++;
+    notify_sleeping(false);
+}
+
+void WorkerPool::schedule(Job&& job, Counter* counter, Counter* dependency, bool main) {
+    if (counter != nullptr) {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        counter->pending++;
+    }
+
+    Pending pending = {std::move(job), counter, main};
+    if (dependency != nullptr) {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->pending > 0) {
+            dependency->continuations.push_back(std::move(pending));
+            return;
+        }
+    }
+    enqueue(std::move(pending), current_worker());
+}
+
+void WorkerPool::submit(Job job, Counter* counter, Counter* dependency) {
+    schedule(std::move(job), counter, dependency, false);
+}
+
+void WorkerPool::submit_main(Job job, Counter* counter, Counter* dependency) {
+    schedule(std::move(job), counter, dependency, true);
+}
+
+bool WorkerPool::take(int worker, Pending& pending) {
+    if (queued.load() == 0) {
+        return false;
+    }
+
+    // Own jobs newest first, they are likely still in the cache, then the oldest ones of the others
+    bool found = (worker >= 0 && queues[worker]->pop(pending)) || shared.steal(pending);
+    for (int i = 1; !found && i < size(); i++) {
+        found = queues[(std::max(worker, 0) + i) % size()]->steal(pending);
+    }
+
+    if (found) {
+        queued--;
+    }
+    return found;
+}
+
+void WorkerPool::execute(Pending& pending, int worker) {
+    {
+        // Captures go away before the counter says the job is done
+        const Job job(std::move(pending.job));
+        job(worker);
+    }
+    finish(pending.counter);
+}
+
+void WorkerPool::finish(Counter* counter) {
+    if (counter == nullptr) {
+        return;
+    }
+
+    std::vector<Pending> ready;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (--counter->pending > 0) {
+            return;
+        }
+        ready.swap(counter->continuations);
+    }
+
+    // The counter may be gone from here on
+    const int worker = current_worker();
+    for (auto& pending : ready) {
+        enqueue(std::move(pending), worker);
+    }
+    notify_sleeping(true);
+}
+
+void WorkerPool::work(int worker) {
+    worker_pool = this;
+    worker_index = worker;
+
+    while (true) {
+        Pending pending;
+        if (take(worker, pending)) {
+            execute(pending, worker);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping++;
+        wake.wait(lock, [this]() { return stop || queued.load() > 0; });
+        sleeping--;
+        if (stop) {
+            return;
+        }
+    }
+}
+
+void WorkerPool::wait(Counter& counter) {
+    const int worker = current_worker();
+
+    while (!counter.done()) {
+        Pending pending;
+        if (worker == 0 && main_queued.load() > 0 && main_jobs.steal(pending)) {
+            main_queued--;
+            execute(pending, worker);
+            continue;
+        }
+        if (worker >= 0 && take(worker, pending)) {
+            execute(pending, worker);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        sleeping++;
+        if (worker >= 0) {
+            wake.wait(lock, [&]() {
+                return counter.done() || queued.load() > 0 || (worker == 0 && main_queued.load() > 0);
+            });
+        } else {
+            finished.wait(lock, [&]() { return counter.done(); });
+        }
+        sleeping--;
+    }
+}
+
+void WorkerPool::run_main_jobs() {
+    Pending pending;
+    while (main_queued.load() > 0 && main_jobs.steal(pending)) {
+        main_queued--;
+        execute(pending, 0);
+    }
+}
+
+void WorkerPool::parallel_for(size_t count, size_t grain, const Task& task) {
+    grain = std::max<size_t>(grain, 1);
+
+    // Threads outside of the pool have no worker index of their own, their work always goes to the workers
+    const int worker = current_worker();
+    if (worker >= 0 && (threads.empty() || count <= grain)) {
+        task(0, count, worker);
+        return;
+    }
+
+    // Chunks are taken dynamically, so uneven items balance out. One job per worker takes part,
+    // the ones which start after everything is taken return right away
+    std::atomic<size_t> next(0);
+    auto run = [&](int worker) {
+        while (true) {
+            const size_t begin = next.fetch_add(grain);
+            if (begin >= count) {
+                return;
+            }
+
+            task(begin, std::min(begin + grain, count), worker);
+        }
+    };
+
+    Counter counter;
+    const size_t chunks = (count + grain - 1) / grain;
+    const int helpers = int(std::min(chunks, size_t(size()))) - (worker >= 0 ? 1 : 0);
+    for (int i = 0; i < helpers; i++) {
+        submit([&run](int worker) { run(worker); }, &counter);
+    }
+
+    if (worker >= 0) {
+        run(worker);
+    }
+    wait(counter);
+}
@@ -0,0 +1,136 @@
+#ifndef SPACEOBJECTS_WORKERPOOL_H
+#define SPACEOBJECTS_WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work stealing job scheduler on persistent worker threads.
+// Every worker has its own deque: it runs its newest jobs first and idle workers steal the oldest ones
+// of the others. The thread which created the pool is worker 0, it takes part in the work while it waits
+// and is the only one to run the jobs submitted for it, such as GL calls. Other threads may submit
+// and wait as well, their jobs go to a shared queue and never run on the submitting thread, so the worker
+// index stays unique to one thread at a time. A pool without threads runs everything on the calling
+// thread as worker 0, so only the thread which created it may use it.
+class WorkerPool {
+public:
+    // Body of a parallel loop: processes [begin, end) on the worker with the given index
+    typedef std::function<void(size_t begin, size_t end, int worker)> Task;
+
+    typedef std::function<void(int worker)> Job;
+
+    class Counter;
+
+private:
+    struct Pending {
+        Job job;
+        Counter* counter;
+        bool main;  // Has to run on worker 0
+    };
+
+    // Deque of jobs in a ring buffer growing in powers of two, the owner works at the back and thieves at the front
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Pending> ring;
+        size_t head = 0;
+        size_t tail = 0;
+
+        void push(Pending&& pending);
+
+        bool pop(Pending& pending);
+
+        bool steal(Pending& pending);
+    };
+
+public:
+    // Number of unfinished jobs of a group. Waiting on it returns once all of them are done,
+    // jobs submitted after it run when it drops to zero. Has to outlive the jobs it counts
+    class Counter {
+        friend class WorkerPool;
+
+        mutable std::mutex mutex;
+        int pending = 0;
+        std::vector<Pending> continuations;
+
+    public:
+        Counter() = default;
+
+        Counter(const Counter&) = delete;
+        Counter& operator=(const Counter&) = delete;
+
+        bool done() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return pending == 0;
+        }
+    };
+
+private:
+    std::vector<std::thread> threads;
+    std::thread::id main_thread;
+
+    std::vector<std::unique_ptr<Queue>> queues;  // One per worker
+    Queue shared;                                // Submitted by threads outside of the pool
+    Queue main_jobs;
+
+    std::mutex mutex;
+    std::condition_variable wake;      // Idle workers and workers waiting for a counter
+    std::condition_variable finished;  // Other threads waiting for a counter
+    std::atomic<int> queued;           // Jobs in the deques and the shared queue
+    std::atomic<int> main_queued;
+    std::atomic<int> sleeping;
+    bool stop = false;
+
+    // Index of the calling thread, -1 outside of the pool
+    int current_worker() const;
+
+    void enqueue(Pending&& pending, int worker);
+
+    void schedule(Job&& job, Counter* counter, Counter* dependency, bool main);
+
+    bool take(int worker, Pending& pending);
+
+    void execute(Pending& pending, int worker);
+
+    void finish(Counter* counter);
+
+    void notify_sleeping(bool all);
+
+    void work(int worker);
+
+public:
+    // By default one thread per core besides the calling one, and at least one
+    explicit WorkerPool(int nb_threads = -1);
+
+    // Jobs still queued are dropped, wait for them first
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    // Number of workers including the calling thread
+    int size() const {
+        return int(threads.size()) + 1;
+    }
+
+    // Run the job on any worker, after `dependency` drops to zero if given. `counter` counts it until it is done
+    void submit(Job job, Counter* counter = nullptr, Counter* dependency = nullptr);
+
+    // Same for jobs which have to run on the thread which created the pool
+    void submit_main(Job job, Counter* counter = nullptr, Counter* dependency = nullptr);
+
+    // Return once the counter drops to zero. Workers run other jobs meanwhile, the other threads sleep
+    void wait(Counter& counter);
+
+    // Run the jobs submitted for the thread which created the pool so far, once per frame or so
+    void run_main_jobs();
+
+    // Split [0, count) into chunks of `grain` elements and process them on all workers.
+    // Returns when everything is done
+    void parallel_for(size_t count, size_t grain, const Task& task);
+};
+
+#endif //SPACEOBJECTS_WORKERPOOL_H
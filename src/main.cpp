@@ -5,18 +5,60 @@
 #include "Camera.h"
 #include "Font.h"
 #include "ShadowMap.h"
+#include "LineBatch.h"
+#include "ParticleSystem.h"
+#include "GpuParticles.h"
+#include "FrameGraph.h"
+#include "RenderCommands.h"
+#include "SceneState.h"
+#include "DynamicResolution.h"
+#include "OcclusionCulling.h"
+#include "ShaderPermutations.h"
+#include "ClusteredLights.h"
+#include "TransformHierarchy.h"
+#include "Entities.h"
+#include "Benchmarks.h"
+#include "Broadphase.h"
+#include "RayQuery.h"
+#include "Allocations.h"
+#include "FrameArena.h"
 
 // External dependencies
 #define GLFW_DLL
 #include <GLFW/glfw3.h>
 #include <random>
 #include <il.h>
+#include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/vector_angle.hpp>
 #include <list>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 // Window size
 static const GLsizei WIDTH = 1280, HEIGHT = 720;
 
+// Simulation runs with a fixed step independent of the frame rate
+static const double SIMULATION_STEP = 1.0 / 60.0;
+static const int MAX_STEPS_PER_FRAME = 5;
+
+// Entities are created and removed without allocating up to this count, spawning stops at it
+static const size_t MAX_ENTITIES = 256;
+static const int ASTEROID_SPAWN_PERIOD = 30;  // Simulation steps
+
+// Initial blocks of the arenas of transient data, they grow to what the frames need
+static const size_t FRAME_ARENA_SIZE = 1024 * 1024;
+static const size_t STEP_ARENA_SIZE = 64 * 1024;
+
+// Antialiasing of the offscreen scene target, the window itself is single sampled
+static const GLsizei SCENE_SAMPLES = 4;
+
+// Texture units of the object shaders: 0 - diffuse, 1 - shadow map, 2..4 - light clusters, 5..7 - G-buffer
+static const int CLUSTER_TEXTURE_UNIT = 2;
+static const int GBUFFER_TEXTURE_UNIT = 5;
+
 int initGL() {
     if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
         std::cout << "Failed to initialize OpenGL context" << std::endl;
@@ -42,7 +84,11 @@ const glm::vec3 up(0.0f, scale, 0.0f);
 static bool permitMouseMove = false;
 
 // Prepare transformations
-const auto perspective = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, 0.1f, 80.0f);
+static const float Z_NEAR = 0.1f, Z_FAR = 80.0f;
+const auto perspective = glm::perspective(glm::radians(45.0f), float(WIDTH) / HEIGHT, Z_NEAR, Z_FAR);
+
+// Directional light of the scene, world space direction the light travels in
+static const glm::vec3 LIGHT_DIRECTION = glm::vec3(-15.f, -15.f, -35.f);
 
 static float yaw = 0.0;
 static float pitch = 0.0;
@@ -86,7 +132,13 @@ enum class ShaderType {
     CLASSIC,
     SKYBOX,
     PARTICLES,
-    DEPTH
+    DEPTH,
+    LINES,
+    EXPLOSION,
+    GPU_PARTICLES_UPDATE,
+    GPU_PARTICLES,
+    DEFERRED,
+    OVERDRAW
 };
 
 // Callback for movement controls
@@ -101,6 +153,15 @@ float multiplier = 0.1f;
 glm::vec3 step = {0.0f, 0.0f, 0.0f};
 CameraMode camera_mode = CameraMode::FIRST_PERSON;
 ShaderType main_shader = ShaderType::CLASSIC;
+bool show_bboxes = false;
+bool vsync = true;
+bool dynamic_resolution = true;
+bool occlusion_culling = true;
+bool print_stats = false;
+int shadow_quality = 2;  // 0 - off, 1 - single tap, 2 - Poisson
+BroadphaseType broadphase_type = BroadphaseType::SWEEP_AND_PRUNE;
+bool clustered_lighting = true;
+bool depth_prepass = true;
 static void keyboardControls(GLFWwindow *window, int key, int scancode, int action, int mods) {
     switch (key) {
         case GLFW_KEY_W:
@@ -163,6 +224,61 @@ static void keyboardControls(GLFWwindow *window, int key, int scancode, int acti
                 main_shader = ShaderType::DEPTH;
             }
             break;
+        case GLFW_KEY_3:
+            if (action == GLFW_PRESS) {
+                main_shader = ShaderType::DEFERRED;
+            }
+            break;
+        case GLFW_KEY_4:
+            if (action == GLFW_PRESS) {
+                main_shader = ShaderType::OVERDRAW;
+            }
+            break;
+        case GLFW_KEY_Z:
+            if (action == GLFW_PRESS) {
+                depth_prepass = !depth_prepass;
+            }
+            break;
+        case GLFW_KEY_B:
+            if (action == GLFW_PRESS) {
+                show_bboxes = !show_bboxes;
+            }
+            break;
+        case GLFW_KEY_V:
+            if (action == GLFW_PRESS) {
+                vsync = !vsync;
+            }
+            break;
+        case GLFW_KEY_N:
+            if (action == GLFW_PRESS) {
+                dynamic_resolution = !dynamic_resolution;
+            }
+            break;
+        case GLFW_KEY_O:
+            if (action == GLFW_PRESS) {
+                occlusion_culling = !occlusion_culling;
+            }
+            break;
+        case GLFW_KEY_P:
+            if (action == GLFW_PRESS) {
+                print_stats = true;
+            }
+            break;
+        case GLFW_KEY_L:
+            if (action == GLFW_PRESS) {
+                clustered_lighting = !clustered_lighting;
+            }
+            break;
+        case GLFW_KEY_F4:
+            if (action == GLFW_PRESS) {
+                shadow_quality = (shadow_quality + 1) % 3;
+            }
+            break;
+        case GLFW_KEY_F5:
+            if (action == GLFW_PRESS) {
+                broadphase_type = BroadphaseType((int(broadphase_type) + 1) % int(BroadphaseType::COUNT));
+            }
+            break;
         case GLFW_KEY_F2:
             if (action == GLFW_PRESS) {
                 camera_mode = CameraMode::FIRST_PERSON;
@@ -181,23 +297,62 @@ static void keyboardControls(GLFWwindow *window, int key, int scancode, int acti
     }
 }
 
+// Controls as seen by the simulation thread, copied from the callbacks once per frame
+struct InputState {
+    glm::vec3 step = glm::vec3(0.0f);
+    float multiplier = 0.1f;
+    float yaw = 0.0f;
+    float pitch = 0.0f;
+    CameraMode camera_mode = CameraMode::FIRST_PERSON;
+    BroadphaseType broadphase = BroadphaseType::SWEEP_AND_PRUNE;
+    bool shoot = false;
+};
+
+// Short lived point light of a laser hit or an explosion
+struct LightFlash {
+    glm::vec3 position;
+    glm::vec3 color;
+    float radius;
+    float age;
+    float lifetime;
+};
+
 class Game {
 public:
     GLFWwindow *window;
 
     std::unordered_map<ShaderType, ShaderProgram> shader_programs;
+    ShaderPermutations object_programs;  // Variants of the classic shader
+    ShaderPermutations gbuffer_programs;  // Material variants writing the G-buffer
+    ShaderPermutations lighting_programs;  // Full screen lighting of the G-buffer, by pass features
+    GLuint fullscreen_vao = 0;  // Empty, the full screen triangle comes from gl_VertexID
     Camera camera;
     SkyBox skybox;
     Particles particles;
+    ParticleSystem explosions;
+    GpuParticles thruster;
     Crosshair crosshair;
     Laser laser;
+    LineBatch lines;
     const int laser_recharge_rate = 15;
     ModelFactory model_factory;
 
     int score = 0;
-    float main_ship_hp = 100.0;
-    std::list<Model> enemies;
-    std::list<Asteroid> asteroids;
+
+    // Simulation thread only
+    TransformHierarchy transforms;  // Entities and the parts attached to them
+    EntityStore entities{&transforms};
+    Entity main_ship;
+    TransformHierarchy::Node thruster_node;
+    TransformHierarchy::Node camera_rig;   // Follows the position of the camera
+    TransformHierarchy::Node camera_node;  // Eye on the rig, its world transform is the inverse of the view
+    glm::mat4 camera_prev_world;
+
+    std::unique_ptr<Broadphase> broadphase;
+    BroadphaseType broadphase_backend;
+    std::vector<BroadphasePair> collision_pairs;
+    FrameArena step_arena{STEP_ARENA_SIZE};  // Data of one step, the last step stays readable
+    FrameVector<Entity> ship_contacts;  // Touching the main ship in the last step
 
     Font font;
 
@@ -206,10 +361,63 @@ public:
     glm::vec3 particles_state = glm::vec3(0.0f, 0.0f, 0.0f);
     float speed_multiplier = 1.0f;
 
+    Entity asteroid;
+    glm::vec3 asteroid_center;
+    float asteroid_state = 0.f;
+
+    std::mt19937 spawn_random{42};
+    int spawn_countdown = ASTEROID_SPAWN_PERIOD;
+    AllocationCount step_allocations;    // Simulation thread, last step
+    AllocationCount frame_allocations;   // Render thread, last frame
+
+    glm::vec3 laser_src;
     glm::vec3 laser_dst;
+    PackedBounds laser_targets;
 
     const glm::vec4 view_port = glm::vec4(0.0f, 0.0f, WIDTH, HEIGHT);
 
+    // Shadows
+    ShadowMap shadow_map = ShadowMap(
+        glm::ortho<float>(-30, 30, -20, 20, 10, 80)
+      * glm::lookAt(glm::vec3(12, 12, -12), glm::vec3(0, 0, -40), glm::vec3(0, 1, 0))
+    );
+    glm::mat4 depth_matrix;
+
+    WorkerPool workers;  // Created by the GL thread, main jobs run on it once per frame
+    CommandRecorder commands;
+    OcclusionCuller occlusion;
+
+    // Render thread data of one frame, the previous frame stays readable
+    FrameArena frame_arena{FRAME_ARENA_SIZE};
+
+    LightClusters light_clusters;
+    std::vector<LightFlash> flashes;
+    FrameVector<PointLight> lights;  // Lights of the current frame
+    FrameVector<SceneItem> scene;
+
+    FrameGraph frame_graph;
+    FrameGraph::Resource backbuffer;
+    FrameGraph::Resource shadow_depth;
+    FrameGraph::Resource scene_color;
+    FrameGraph::Resource scene_depth;
+    FrameGraph::Resource scene_resolved;  // Single sampled scene color, scene_color itself without multisampling
+    FrameGraph::Resource gbuffer_albedo;
+    FrameGraph::Resource gbuffer_normal;
+    FrameGraph::Resource gbuffer_depth;
+
+    DynamicResolution resolution;
+
+    // The simulation runs on its own thread and hands the results of its steps
+    // to the render thread through the snapshots, neither side waits for the other
+    std::thread simulation;
+    std::atomic<bool> running{false};
+    std::mutex input_mutex;
+    InputState input;
+    TripleBuffer<SceneSnapshot> snapshots;
+    EventQueue<BurstEvent, 256> bursts;
+
+    const SceneSnapshot* frame = nullptr;  // Snapshot drawn by the render thread
+
     Game() = default;
 
     int init_GL() {
@@ -220,7 +428,6 @@ public:
         glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
         glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
         glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-        glfwWindowHint(GLFW_SAMPLES, 4);
 
         window = glfwCreateWindow(WIDTH, HEIGHT, "Lights and Shadows", nullptr, nullptr);
         if (window == nullptr) {
@@ -253,11 +460,61 @@ public:
     }
 
     void compile_shaders() {
-        shader_programs[ShaderType::CLASSIC] = ShaderProgram({
+        ShaderProgram::EnableBinaryCache("shader_cache");
+
+        // Variants are compiled once the materials are known, see request_shader_variants
+        object_programs = ShaderPermutations({
             {GL_VERTEX_SHADER,   "shaders/classic/classic_vertex.glsl"},
             {GL_FRAGMENT_SHADER, "shaders/classic/classic_fragment.glsl"},
+        }, [](ShaderProgram& program, uint32_t features) {
+            program.BindUniformBlock("ObjectBlock", CommandRecorder::uniform_binding);
+
+            program.StartUseShader();
+            if (features & FEATURE_TEXTURE) {
+                program.SetUniform("Texture", 0);
+            }
+            if (features & FEATURE_SHADOW_MASK) {
+                program.SetUniform("shadow_map", 1);
+            }
+            if (features & FEATURE_CLUSTERED_LIGHTS) {
+                program.SetUniform("light_data", CLUSTER_TEXTURE_UNIT);
+                program.SetUniform("light_clusters", CLUSTER_TEXTURE_UNIT + 1);
+                program.SetUniform("light_indices", CLUSTER_TEXTURE_UNIT + 2);
+            }
+            program.StopUseShader();
+        });
+
+        gbuffer_programs = ShaderPermutations({
+            {GL_VERTEX_SHADER,   "shaders/deferred/gbuffer_vertex.glsl"},
+            {GL_FRAGMENT_SHADER, "shaders/deferred/gbuffer_fragment.glsl"},
+        }, [](ShaderProgram& program, uint32_t features) {
+            program.BindUniformBlock("ObjectBlock", CommandRecorder::uniform_binding);
+
+            if (features & FEATURE_TEXTURE) {
+                program.StartUseShader();
+                program.SetUniform("Texture", 0);
+                program.StopUseShader();
+            }
+        });
+
+        lighting_programs = ShaderPermutations({
+            {GL_VERTEX_SHADER,   "shaders/deferred/lighting_vertex.glsl"},
+            {GL_FRAGMENT_SHADER, "shaders/deferred/lighting_fragment.glsl"},
+        }, [](ShaderProgram& program, uint32_t features) {
+            program.StartUseShader();
+            program.SetUniform("gbuffer_albedo", GBUFFER_TEXTURE_UNIT);
+            program.SetUniform("gbuffer_normal", GBUFFER_TEXTURE_UNIT + 1);
+            program.SetUniform("gbuffer_depth", GBUFFER_TEXTURE_UNIT + 2);
+            if (features & FEATURE_SHADOW_MASK) {
+                program.SetUniform("shadow_map", 1);
+            }
+            if (features & FEATURE_CLUSTERED_LIGHTS) {
+                program.SetUniform("light_data", CLUSTER_TEXTURE_UNIT);
+                program.SetUniform("light_clusters", CLUSTER_TEXTURE_UNIT + 1);
+                program.SetUniform("light_indices", CLUSTER_TEXTURE_UNIT + 2);
+            }
+            program.StopUseShader();
         });
-        GL_CHECK_ERRORS;
 
         shader_programs[ShaderType::SKYBOX] = ShaderProgram({
             {GL_VERTEX_SHADER,   "shaders/skybox/skybox_vertex.glsl"},
@@ -277,6 +534,63 @@ public:
             {GL_FRAGMENT_SHADER, "shaders/depth/depth_fragment.glsl"},
         });
         GL_CHECK_ERRORS;
+
+        shader_programs[ShaderType::DEPTH].BindUniformBlock("ObjectBlock", CommandRecorder::uniform_binding);
+        GL_CHECK_ERRORS;
+
+        shader_programs[ShaderType::OVERDRAW] = ShaderProgram({
+            {GL_VERTEX_SHADER,   "shaders/depth/depth_vertex.glsl"},
+            {GL_FRAGMENT_SHADER, "shaders/overdraw/overdraw_fragment.glsl"},
+        });
+        GL_CHECK_ERRORS;
+
+        shader_programs[ShaderType::OVERDRAW].BindUniformBlock("ObjectBlock", CommandRecorder::uniform_binding);
+        GL_CHECK_ERRORS;
+
+        shader_programs[ShaderType::LINES] = ShaderProgram({
+            {GL_VERTEX_SHADER,   "shaders/lines/lines_vertex.glsl"},
+            {GL_FRAGMENT_SHADER, "shaders/lines/lines_fragment.glsl"},
+        });
+        GL_CHECK_ERRORS;
+
+        shader_programs[ShaderType::EXPLOSION] = ShaderProgram({
+            {GL_VERTEX_SHADER,   "shaders/explosion/explosion_vertex.glsl"},
+            {GL_FRAGMENT_SHADER, "shaders/explosion/explosion_fragment.glsl"},
+        });
+        GL_CHECK_ERRORS;
+
+        shader_programs[ShaderType::GPU_PARTICLES_UPDATE] = ShaderProgram({
+            {GL_VERTEX_SHADER,   "shaders/gpu_particles/update_vertex.glsl"},
+        }, GpuParticles::feedback_varyings());
+        GL_CHECK_ERRORS;
+
+        shader_programs[ShaderType::GPU_PARTICLES] = ShaderProgram({
+            {GL_VERTEX_SHADER,   "shaders/gpu_particles/render_vertex.glsl"},
+            {GL_FRAGMENT_SHADER, "shaders/explosion/explosion_fragment.glsl"},
+        });
+        GL_CHECK_ERRORS;
+    }
+
+    // Shader features set for the whole frame rather than by materials
+    static uint32_t pass_features() {
+        return (uint32_t(shadow_quality) << 2) | (clustered_lighting ? FEATURE_CLUSTERED_LIGHTS : 0u);
+    }
+
+    // Compile only the variants of the object shaders used by the loaded materials
+    void request_shader_variants() {
+        for (const auto& pair : model_factory.get_models()) {
+            for (const auto& object : pair.second.objects) {
+                const uint32_t features = (object.haveTexture() ? FEATURE_TEXTURE : 0u)
+                                        | (object.alphaTest() ? FEATURE_ALPHA_TEST : 0u);
+                object_programs.request(features | pass_features());
+                gbuffer_programs.request(features);
+            }
+        }
+        lighting_programs.request(pass_features());
+
+        object_programs.compile();
+        gbuffer_programs.compile();
+        lighting_programs.compile();
     }
 
     void load_skybox() {
@@ -290,15 +604,66 @@ public:
         });
     }
 
+    Entity spawn(ModelName name, const glm::vec3& position, const glm::mat4& orientation = glm::mat4(1.0f),
+                 const glm::vec3& velocity = glm::vec3(0.0f)) {
+        const auto& model = model_factory.get_prototype(name);
+        return entities.create(&model, model.bbox, position, orientation, velocity);
+    }
+
+    // Asteroid flying from far ahead of the camera towards it, while the pool has room
+    void spawn_asteroid() {
+        if (entities.size() >= entities.capacity()) return;
+
+        std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+        std::uniform_real_distribution<float> scale(0.5f, 1.5f);
+
+        const auto position = camera.position + glm::vec3(40.0f * offset(spawn_random), 20.0f * offset(spawn_random), -120.0f);
+        const auto target = camera.position + glm::vec3(10.0f * offset(spawn_random), 5.0f * offset(spawn_random), 0.0f);
+        const auto direction = glm::normalize(target - position);
+
+        const auto orientation = glm::toMat4(glm::rotation(glm::vec3(0.0f, 0.0f, 1.0f), direction))
+                               * glm::scale(glm::mat4(1.0f), glm::vec3(scale(spawn_random)));
+        const auto spawned = spawn(ModelName::ASTEROID1, position, orientation, 0.3f * direction);
+        entities.transient[entities.index(spawned)] = 1;
+    }
+
+    // Spawned asteroids fly past the camera and are removed behind it, their slots go to the next ones
+    void despawn_passed() {
+        for (size_t i = 0; i < entities.size();) {
+            if (entities.transient[i] && entities.positions[i].z > camera.position.z + 20.0f) {
+                entities.remove(entities.handle(i));
+            } else {
+                i++;
+            }
+        }
+    }
+
     void init_objects() {
+        // Spawning and removal reuse the pool without allocating, the hierarchy also holds attached parts
+        entities.reserve(MAX_ENTITIES);
+        transforms.reserve(2 * MAX_ENTITIES);
+
         // Main ship
-        enemies.push_back(model_factory.get_model(ModelName::E45_AIRCRAFT, glm::vec3(3.6, 1.9, -31.9)));
+        main_ship = spawn(ModelName::E45_AIRCRAFT, glm::vec3(3.6, 1.9, -31.9));
 
         // Stationary object
-        enemies.push_back(model_factory.get_model(ModelName::REPVENATOR, glm::vec3(0., 0., -50.)));
+        spawn(ModelName::REPVENATOR, glm::vec3(0., 0., -50.));
 
         // Moving object
-        enemies.push_back(model_factory.get_model(ModelName::ASTEROID1, glm::vec3(10., 5., -35.)));
+        asteroid = spawn(ModelName::ASTEROID1, glm::vec3(10., 5., -35.));
+
+        // Exhaust goes out of the back of the main ship and follows it
+        const auto& ship_bounds = entities.local_bounds[entities.index(main_ship)];
+        const auto back = glm::vec3(0.5f * (ship_bounds.min.x + ship_bounds.max.x),
+                                    0.5f * (ship_bounds.min.y + ship_bounds.max.y), ship_bounds.max.z);
+        thruster_node = transforms.create(glm::translate(glm::mat4(1.0f), back), entities.nodes[entities.index(main_ship)]);
+
+        camera_rig = transforms.create();
+        camera_node = transforms.create(glm::mat4(1.0f), camera_rig);
+        place_camera();
+
+        entities.update_transforms();
+        detect_collisions(broadphase_type);
     }
 
     int init() {
@@ -321,17 +686,37 @@ public:
         std::cout << "\x1b[32mDone\x1b[0m" << std::endl;
 
         std::cout << "Loading models... ";
-        model_factory.load();
+        {
+            AllocationScope scope("assets");
+            model_factory.load(&workers);
+        }
         std::cout << "\x1b[32mDone\x1b[0m" << std::endl;
 
+        std::cout << "Compiling shader variants... ";
+        request_shader_variants();
+        std::cout << "\x1b[32mDone\x1b[0m ("
+                  << object_programs.size() + gbuffer_programs.size() + lighting_programs.size() << ")" << std::endl;
+
         font = Font("models/arial.ttf");
         crosshair.init();
-        laser.init();
+        lines.init();
+        commands.init(&workers, &frame_arena);
+        occlusion.init(&workers);
+        light_clusters.init(Z_NEAR, Z_FAR);
+        glGenVertexArrays(1, &fullscreen_vao);
+        resolution.init();
         particles = Particles(1000);
+        explosions = ParticleSystem(1 << 18);
+        thruster = GpuParticles(1 << 17);
 
         init_objects();
 
-        glfwSwapInterval(1); // force 60 frames per second
+        if (shadow_map.init(WIDTH, HEIGHT) != 0) {
+            std::cerr << "Failed to initialize shadow map" << std::endl;
+            return -1;
+        }
+
+        glfwSwapInterval(vsync ? 1 : 0); // Game speed doesn't depend on it, the simulation has a fixed step
 
         glEnable(GL_MULTISAMPLE);
         glEnable(GL_DEPTH_TEST);
@@ -342,28 +727,370 @@ public:
         return 0;
     }
 
-    // Game mechanics
+    // Game mechanics, owned by the simulation thread
 
-    double xpos, ypos;
-    glm::mat4 view_transform;
-    glm::mat4 perspective_transform;
     glm::vec3 camera_shift;
 
-    void modify_env() {
-        const auto time = glfwGetTime();
+    void store_state() {
+        entities.store_state();
+        camera_prev_world = transforms.get_world(camera_node);
+    }
 
-        smooth_step += 0.05f * (step - smooth_step);
-        camera_shift = multiplier * smooth_step;
-        camera.mode = camera_mode;
-        camera.rot = glm::quat({yaw, pitch, 0.0f});
+    // The rig carries the position, the eye sits on it as the mode and the orientation want
+    void place_camera() {
+        transforms.set_local(camera_rig, glm::translate(glm::mat4(1.0f), camera.position));
+        transforms.set_local(camera_node, camera.getEyeTransform());
+    }
+
+    // One step of the simulation. Rates below are per step of SIMULATION_STEP seconds
+    void update() {
+        const auto allocations_before = thread_allocation_count();
+        step_arena.begin_frame();
+
+        store_state();
+
+        InputState controls;
+        {
+            std::lock_guard<std::mutex> lock(input_mutex);
+            controls = input;
+            input.shoot = false;
+        }
+
+        camera.mode = controls.camera_mode;
+        camera.rot = glm::quat({controls.yaw, controls.pitch, 0.0f});
+
+        smooth_step += 0.05f * (controls.step - smooth_step);
+        camera_shift = controls.multiplier * smooth_step;
         camera.move(camera_shift);
+        place_camera();
+
+        particles_state += speed_multiplier * enemies_speed;
+        speed_multiplier += 0.0001f;
+
+        constexpr float asteroid_step = 2 * M_PI / 60 / 10;  // Round every 10 seconds
+        if (entities.alive(asteroid)) {
+            entities.set_position(entities.index(asteroid),
+                                  asteroid_center + 10.f * glm::vec3(sinf(asteroid_state), 0.f, cosf(asteroid_state)));
+        }
+        asteroid_state += asteroid_step;
+
+        // World transforms and bounds of everything that moved, before the laser and the effects query them
+        entities.integrate();
+        entities.update_transforms(&workers);
+
+        detect_collisions(controls.broadphase);
+
+        if (laser.recharge > 0) {
+            laser.recharge--;
+        }
+        if (controls.shoot && laser.recharge == 0) {
+            shoot_laser();
+        }
+
+        {
+            // The entity pool is reserved up front
+            ZeroAllocationScope no_allocations("spawning and despawning");
+            update_dying();
+
+            if (--spawn_countdown == 0) {
+                spawn_asteroid();
+                spawn_countdown = ASTEROID_SPAWN_PERIOD;
+            }
+            despawn_passed();
+        }
+
+        step_allocations = thread_allocation_count() - allocations_before;
+    }
+
+    // Overlapping entities of this step. The main ship is damaged once per contact
+    void detect_collisions(BroadphaseType type) {
+        if (!broadphase || broadphase_backend != type) {
+            broadphase = Broadphase::create(type);
+            broadphase_backend = type;
+        }
+
+        broadphase->update(entities.bounds.data(), entities.size());
+        broadphase->find_pairs(collision_pairs);
+
+        const auto ship = uint32_t(entities.index(main_ship));
+        FrameVector<Entity> new_contacts(step_arena);
+        for (const auto& pair : collision_pairs) {
+            if (pair.first != ship && pair.second != ship) continue;
+
+            const uint32_t other = pair.first == ship ? pair.second : pair.first;
+            if (entities.dying(other)) continue;
+
+            const auto contact = entities.handle(other);
+            new_contacts.push_back(contact);
+            if (std::find(ship_contacts.begin(), ship_contacts.end(), contact) == ship_contacts.end()) {
+                entities.health[ship] -= entities.models[other]->damage;
+            }
+        }
+        ship_contacts.swap(new_contacts);
+    }
+
+    // Copy the result of the last step for the render thread
+    void publish_state(double time) {
+        auto& state = snapshots.write_buffer();
+        state.time = time;
+
+        state.models.clear();
+        for (size_t i = 0; i < entities.size(); i++) {
+            if (entities.dying(i)) continue;
+
+            auto orientation = entities.world_transforms[i];
+            orientation[3] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            state.models.push_back({entities.prev_positions[i], entities.get_world_position(i), orientation, entities.models[i]});
+        }
+
+        state.camera_prev_world = camera_prev_world;
+        state.camera_world = transforms.get_world(camera_node);
+        state.camera_position = camera.position;
+        state.camera_shift = camera_shift;
+
+        state.particles_state = particles_state;
+        state.enemies_speed = enemies_speed;
 
-        view_transform = camera.getViewTransform();
+        state.thruster_position = glm::vec3(transforms.get_world(thruster_node)[3]);
+
+        state.broadphase = broadphase->name();
+        state.collision_pairs = collision_pairs.size();
+        state.main_ship_hp = entities.health[entities.index(main_ship)];
+        state.entities = entities.size();
+        state.step_allocations = step_allocations;
+        state.step_arena = step_arena.get_stats();
+
+        state.laser_visible = laser.recharge > laser_recharge_rate / 2;
+        state.laser_src = laser_src;
+        state.laser_dst = laser_dst;
+
+        snapshots.publish();
+    }
+
+    void simulation_loop() {
+        double previous_time = glfwGetTime();
+        double accumulator = 0.0;
+
+        while (running) {
+            // Catch up with the wall clock in fixed steps. After a stall only a bounded
+            // number of steps is made, so the game slows down instead of spiralling
+            const double time = glfwGetTime();
+            accumulator += std::min(time - previous_time, MAX_STEPS_PER_FRAME * SIMULATION_STEP);
+            previous_time = time;
+
+            if (accumulator >= SIMULATION_STEP) {
+                AllocationScope scope("simulation");
+                while (accumulator >= SIMULATION_STEP) {
+                    update();
+                    accumulator -= SIMULATION_STEP;
+                }
+                publish_state(time - accumulator);
+            }
+
+            std::this_thread::sleep_for(std::chrono::duration<double>(SIMULATION_STEP - accumulator));
+        }
+    }
+
+    // Hand the controls over to the simulation thread
+    void publish_input() {
+        std::lock_guard<std::mutex> lock(input_mutex);
+        input.step = step;
+        input.multiplier = multiplier;
+        input.yaw = yaw;
+        input.pitch = pitch;
+        input.camera_mode = camera_mode;
+        input.broadphase = broadphase_type;
+        if (shoot) {
+            // Stays set until the simulation consumes it
+            input.shoot = true;
+            shoot = false;
+        }
+    }
+
+    // Rendering, owned by the render thread
+
+    double xpos, ypos;
+    glm::mat4 view_transform;
+    glm::mat4 perspective_transform;
+    float frame_alpha = 0.0f;  // Position of the frame between the last two simulation steps
+
+    // Camera of the frame: the world transform of its node, the position interpolated between the last two simulation steps
+    void update_view(float alpha) {
+        auto camera_world = frame->camera_world;
+        camera_world[3] = glm::mix(frame->camera_prev_world[3], frame->camera_world[3], alpha);
+
+        view_transform = glm::inverse(camera_world);
         perspective_transform = perspective * view_transform;
 
         glfwGetCursorPos(window, &xpos, &ypos);
     }
 
+    // Spawn the bursts requested by the simulation since the last frame
+    void spawn_bursts() {
+        BurstEvent event;
+        while (bursts.pop(event)) {
+            explosions.burst(event.position, glm::vec3(0.0f), event.amount, event.color,
+                             event.speed, event.lifetime, event.duration);
+
+            flashes.push_back({event.position, glm::vec3(event.color), 3.0f * event.speed, 0.0f, event.lifetime});
+        }
+    }
+
+    // Collect the point lights of the frame: flashes of hits and explosions, the engine and the laser beam
+    void update_lights(float dt) {
+        lights = FrameVector<PointLight>(frame_arena);
+
+        for (size_t i = 0; i < flashes.size();) {
+            auto& flash = flashes[i];
+            flash.age += dt;
+            if (flash.age >= flash.lifetime) {
+                flash = flashes.back();
+                flashes.pop_back();
+                continue;
+            }
+
+            const float fade = 1.0f - flash.age / flash.lifetime;
+            lights.push_back({flash.position, flash.radius, flash.color, 4.0f * fade * fade});
+            i++;
+        }
+
+        lights.push_back({frame->thruster_position, 6.0f, glm::vec3(0.3f, 0.6f, 1.0f), 2.0f});
+
+        if (frame->laser_visible) {
+            const auto beam = frame->laser_dst - frame->laser_src;
+            const int count = std::max(int(glm::length(beam) / 8.0f), 1);
+            for (int i = 0; i <= count; i++) {
+                const auto position = frame->laser_src + beam * (float(i) / float(count));
+                lights.push_back({position, 5.0f, glm::vec3(laser.color), 1.5f});
+            }
+        }
+    }
+
+    void shoot_laser() {
+        const auto& camera_transform = transforms.get_world(camera_node);
+        const auto direction = -glm::normalize(glm::vec3(camera_transform[2]));
+        laser_src = glm::vec3(camera_transform[3]) - 0.5f * glm::vec3(camera_transform[1]);
+        laser_dst = laser_src + 80.0f * direction;  // Far plane
+
+        laser_targets.assign(entities.bounds.data(), entities.size());
+        laser_targets.disable(entities.index(main_ship));
+        for (size_t i = 0; i < entities.size(); i++) {
+            if (entities.dying(i)) {
+                laser_targets.disable(i);
+            }
+        }
+
+        // Boxes along the ray from the nearest one, until the next box starts behind the closest hull hit.
+        // A ray passes through a few boxes, each one is taken out of the packed set once tested
+        size_t target = entities.size();
+        float distance = 80.0f;
+        while (true) {
+            const auto hit = intersect_nearest(laser_targets, laser_src, direction, distance);
+            if (hit.index == entities.size()) break;
+
+            if (entities.models[hit.index]->intersectRay(entities.world_transforms[hit.index], laser_src, direction, distance)) {
+                target = hit.index;
+            }
+            laser_targets.disable(hit.index);
+        }
+
+        if (target != entities.size()) {
+            laser_dst = laser_src + distance * direction;
+            bursts.push({laser_dst, 2000, glm::vec4(1.0f, 0.9f, 0.6f, 1.0f), 8.0f, 0.3f, 0.0f});
+
+            entities.kill(target);
+            score++;
+        }
+
+        laser.recharge = laser_recharge_rate;
+    }
+
+    void explode(size_t index) {
+        const auto& bbox = entities.bounds[index];
+        const auto center = 0.5f * (bbox.min + bbox.max);
+        const float size = glm::length(bbox.max - bbox.min);
+
+        // Spread the burst over a few frames to avoid a spike in spawning cost.
+        // A full queue only loses the effect, the game state doesn't depend on it
+        bursts.push({center, 100000, glm::vec4(1.0f, 0.55f, 0.2f, 1.0f), size, 2.0f, 0.25f});
+    }
+
+    void update_dying() {
+        for (size_t i = 0; i < entities.size(); i++) {
+            if (entities.death_countdowns[i] == EntityStore::death_duration) {
+                explode(i);
+            }
+        }
+        entities.update_dying();
+    }
+
+    void update_thruster(float dt) {
+        thruster.emitter.position = frame->thruster_position;
+        thruster.emitter.direction = glm::vec3(0.0f, 0.0f, 1.0f);
+        thruster.update(shader_programs[ShaderType::GPU_PARTICLES_UPDATE], dt);
+    }
+
+    void draw_thruster() {
+        auto& program = shader_programs[ShaderType::GPU_PARTICLES];
+        program.StartUseShader();
+        program.SetUniform("transform", perspective_transform);
+        program.SetUniform("point_size", 10.0f * resolution.get_scale());
+
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glDepthMask(GL_FALSE);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+        thruster.draw();
+
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+
+        program.StopUseShader();
+    }
+
+    void draw_explosions() {
+        explosions.upload();
+
+        auto& program = shader_programs[ShaderType::EXPLOSION];
+        program.StartUseShader();
+        program.SetUniform("transform", perspective_transform);
+        program.SetUniform("point_size", 40.0f * resolution.get_scale());
+
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glDepthMask(GL_FALSE);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+
+        explosions.draw();
+
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+
+        program.StopUseShader();
+    }
+
+    void draw_lines() {
+        if (frame->laser_visible) {
+            laser.draw(lines, frame->laser_src, frame->laser_dst);
+        }
+
+        if (show_bboxes) {
+            for (const auto& state : frame->models) {
+                lines.box(state.model->bbox, state.getWorldTransform(frame_alpha), glm::vec4(0.0f, 1.0f, 0.0f, 1.0f));
+            }
+        }
+
+        auto& program = shader_programs[ShaderType::LINES];
+        program.StartUseShader();
+        program.SetUniform("transform", perspective_transform);
+
+        // Everything collected during the frame goes out in one draw per primitive type
+        lines.flush();
+
+        program.StopUseShader();
+    }
+
     void draw_skybox() {
         auto& program = shader_programs[ShaderType::SKYBOX];
 
@@ -384,150 +1111,456 @@ public:
 
         program.StartUseShader();
 
-        program.SetUniform("world_transform", glm::translate(glm::mat4(1.0f), particles_state - camera.position));
+        program.SetUniform("world_transform", glm::translate(glm::mat4(1.0f), frame->particles_state - frame->camera_position));
         program.SetUniform("perspective_transform", perspective * glm::mat4(glm::mat3(view_transform)));
 
-        program.SetUniform("velocity", enemies_speed - camera_shift);
+        program.SetUniform("velocity", frame->enemies_speed - frame->camera_shift);
 
         particles.draw();
 
         program.StopUseShader();
     }
 
-    void draw_objects(const glm::mat4& depth_matrix)
-    {
-        auto& program = shader_programs[ShaderType::CLASSIC];
+    // Snapshot the scene and build the draw commands of all passes on the workers
+    void record_commands() {
+        scene = FrameVector<SceneItem>(frame_arena);
+        scene.reserve(frame->models.size());
+        for (const auto& state : frame->models) {
+            scene.push_back({state.getWorldTransform(frame_alpha), state.model});
+        }
+
+        CommandRecorder::Views views;
+        views.camera = perspective_transform;
+        views.light = shadow_map.matrix;
+        views.depth_matrix = depth_matrix;
+
+        if (occlusion_culling) {
+            occlusion.render(scene, perspective_transform);
+            views.occlusion = &occlusion;
+        }
+
+        commands.record(scene, views);
+    }
+
+    void show_stats() const {
+        const auto& draws = commands.get_stats();
+        const auto& occluders = occlusion.get_stats();
+        const auto& graph = frame_graph.get_stats();
+        const auto& clusters = light_clusters.get_stats();
+        const auto arena = frame_arena.get_stats();
+        const auto main_pass = size_t(RenderPass::MAIN);
+        const auto shadow_pass = size_t(RenderPass::SHADOW);
+
+        std::cout << "Draws: " << draws.draws[main_pass] << " main, " << draws.draws[shadow_pass] << " shadow\n"
+                  << "Culled models: " << draws.culled[main_pass] << " by frustum, "
+                  << draws.occluded[main_pass] << " by occlusion\n"
+                  << "Occlusion: " << occluders.occluders << " occluders, " << occluders.triangles << " triangles, "
+                  << occluders.raster_time << " ms\n"
+                  << "Lights: " << clusters.lights << " lights, " << clusters.references << " cluster references, "
+                  << clusters.max_per_cluster << " max per cluster\n"
+                  << "Collisions: " << frame->collision_pairs << " pairs by " << frame->broadphase
+                  << ", ship hp " << frame->main_ship_hp << "\n"
+                  << "Entities: " << frame->entities << " of " << MAX_ENTITIES << "\n"
+                  << "Heap allocations: " << frame->step_allocations.allocations << " ("
+                  << frame->step_allocations.bytes << " bytes) in the last step, "
+                  << frame_allocations.allocations << " (" << frame_allocations.bytes << " bytes) in the last frame\n"
+                  << "Frame arena: " << arena.used << " of " << arena.capacity << " bytes, "
+                  << arena.high_watermark << " high watermark, " << arena.overflows << " overflows\n"
+                  << "Step arena: " << frame->step_arena.used << " of " << frame->step_arena.capacity << " bytes, "
+                  << frame->step_arena.high_watermark << " high watermark, " << frame->step_arena.overflows << " overflows\n"
+                  << "Resolution: " << resolution.get_scale() << " scale, " << resolution.get_gpu_time() << " ms GPU\n"
+                  << "Frame graph: " << graph.passes << " passes, " << graph.culled << " culled, "
+                  << graph.transient << " transient textures on " << graph.physical << " physical" << std::endl;
+    }
+
+    // Depth of the main pass without colour writes, so the object pass shades only visible fragments
+    void draw_depth_prepass() {
+        auto& program = shader_programs[ShaderType::DEPTH];
         program.StartUseShader();
-        GL_CHECK_ERRORS;
 
-        // Draw enemies
-        for (const auto &model : enemies) {
-            if (model.dead) continue;
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        commands.replay(RenderPass::MAIN, CommandRecorder::BindProgram(), DrawSubset::SOLID);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        GL_CHECK_ERRORS;
 
-            const auto local = perspective_transform * model.getWorldTransform();
-            const auto depth = depth_matrix * model.getWorldTransform();
+        program.StopUseShader();
+    }
 
-            for (const auto &object : model.objects) {
-                const auto transform = local * object.getWorldTransform();
-                program.SetUniform("transform", transform);
+    // Count the fragments the object pass would shade, brighter is more overdraw
+    void draw_overdraw() {
+        auto& program = shader_programs[ShaderType::OVERDRAW];
+        program.StartUseShader();
 
-                const auto depth_transform = depth * object.getWorldTransform();
-                program.SetUniform("depth_transform", depth_transform);
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBlendFunc(GL_ONE, GL_ONE);
 
-                const auto color = object.getDiffuseColor();
-                program.SetUniform("diffuse_color", color);
+        commands.replay(RenderPass::MAIN, [](uint32_t features) {
+            const bool prepassed = depth_prepass && !(features & FEATURE_ALPHA_TEST);
+            glDepthFunc(prepassed ? GL_EQUAL : GL_LESS);
+            glDepthMask(prepassed ? GL_FALSE : GL_TRUE);
+        }, DrawSubset::OPAQUE);
+        glDepthFunc(GL_LESS);
+        commands.replay(RenderPass::MAIN, CommandRecorder::BindProgram(), DrawSubset::TRANSLUCENT);
 
-                const bool use_texture = object.haveTexture();
-                program.SetUniform("use_texture", use_texture);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        GL_CHECK_ERRORS;
 
-                const float opacity = object.getOpacity();
-                program.SetUniform("opacity", opacity);
+        program.StopUseShader();
+    }
 
-                const auto light_direction = glm::vec3(-15.f, -15.f, -35.f);
-                program.SetUniform("light_direction", -light_direction);
+    void draw_objects(DrawSubset subset = DrawSubset::ALL)
+    {
+        const auto frame_features = pass_features();
 
-                program.SetUniform("Texture", 0);
-                program.SetUniform("shadow_map", 1);
+        if (frame_features & FEATURE_CLUSTERED_LIGHTS) {
+            light_clusters.bind(CLUSTER_TEXTURE_UNIT);
+        }
 
-                object.draw();
-                GL_CHECK_ERRORS;
+        // Draws come sorted by variant, so every program is bound once per frame
+        const ShaderProgram* program = nullptr;
+        commands.replay(RenderPass::MAIN, [&](uint32_t features) {
+            program = &object_programs.get(features | frame_features);
+            program->StartUseShader();
+            program->SetUniform("light_direction", -LIGHT_DIRECTION);
+
+            // Alpha tested draws are left out of the depth prepass, the others only shade with its depth
+            const bool prepassed = depth_prepass && subset == DrawSubset::OPAQUE && !(features & FEATURE_ALPHA_TEST);
+            glDepthFunc(prepassed ? GL_EQUAL : GL_LESS);
+            glDepthMask(prepassed ? GL_FALSE : GL_TRUE);
+
+            if (frame_features & FEATURE_CLUSTERED_LIGHTS) {
+                program->SetUniform("view", view_transform);
+                light_clusters.set_uniforms(*program);
             }
+        }, subset);
+        glDepthFunc(GL_LESS);
+        GL_CHECK_ERRORS;
+
+        if (program != nullptr) {
+            program->StopUseShader();
+        }
+        if (frame_features & FEATURE_CLUSTERED_LIGHTS) {
+            light_clusters.unbind(CLUSTER_TEXTURE_UNIT);
+        }
+    }
+
+    // Material attributes of the opaque draws, lit later in screen space
+    void draw_gbuffer() {
+        const ShaderProgram* program = nullptr;
+        commands.replay(RenderPass::MAIN, [&](uint32_t features) {
+            program = &gbuffer_programs.get(features & (FEATURE_TEXTURE | FEATURE_ALPHA_TEST));
+            program->StartUseShader();
+        }, DrawSubset::OPAQUE);
+        GL_CHECK_ERRORS;
+
+        if (program != nullptr) {
+            program->StopUseShader();
+        }
+    }
+
+    // Shade every covered pixel of the G-buffer once, the skybox stays where nothing was drawn
+    void draw_deferred_lighting(const FrameGraph& graph) {
+        const auto frame_features = pass_features();
+        auto& program = lighting_programs.get(frame_features);
+
+        const GLuint gbuffer[] = {
+            graph.get_texture(gbuffer_albedo),
+            graph.get_texture(gbuffer_normal),
+            graph.get_texture(gbuffer_depth),
+        };
+        for (int i = 0; i < 3; i++) {
+            glActiveTexture(GLenum(GL_TEXTURE0 + GBUFFER_TEXTURE_UNIT + i));
+            glBindTexture(GL_TEXTURE_2D, gbuffer[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+
+        if (frame_features & FEATURE_CLUSTERED_LIGHTS) {
+            light_clusters.bind(CLUSTER_TEXTURE_UNIT);
         }
+
+        program.StartUseShader();
+        program.SetUniform("inverse_view_projection", glm::inverse(perspective_transform));
+        program.SetUniform("light_direction", -LIGHT_DIRECTION);
+        // Variants without the feature don't have the uniform
+        if (frame_features & FEATURE_SHADOW_MASK) {
+            program.SetUniform("depth_matrix", depth_matrix);
+        }
+        if (frame_features & FEATURE_CLUSTERED_LIGHTS) {
+            program.SetUniform("view", view_transform);
+            light_clusters.set_uniforms(program);
+        }
+
+        glDisable(GL_DEPTH_TEST);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(fullscreen_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glEnable(GL_DEPTH_TEST);
+
         program.StopUseShader();
+        GL_CHECK_ERRORS;
+
+        if (frame_features & FEATURE_CLUSTERED_LIGHTS) {
+            light_clusters.unbind(CLUSTER_TEXTURE_UNIT);
+        }
     }
 
-    void draw_depth(const glm::mat4& matrix) {
+    void draw_depth() {
         auto& program = shader_programs[ShaderType::DEPTH];
         program.StartUseShader();
         GL_CHECK_ERRORS;
 
-        // Draw enemies
-        for (const auto &model : enemies) {
-            if (model.dead) continue;
-            const auto local = matrix * model.getWorldTransform();
-            for (const auto &object : model.objects) {
-                const auto transform = local * object.getWorldTransform();
-                program.SetUniform("transform", transform);
+        commands.replay(RenderPass::SHADOW);
+        GL_CHECK_ERRORS;
+
+        program.StopUseShader();
+    }
+
+    // Declare the passes of the frame and let the frame graph schedule them
+    void render_frame() {
+        frame_graph.reset(frame_arena);
+
+        backbuffer = frame_graph.import_backbuffer("backbuffer", WIDTH, HEIGHT);
+
+        frame_graph.add_pass("shadow", [this](FrameGraph::Builder& builder) {
+            shadow_depth = builder.create("shadow_depth", TextureDesc(shadow_map.width, shadow_map.height, GL_DEPTH_COMPONENT32));
+            builder.clear(GL_DEPTH_BUFFER_BIT);
+        }, [this](const FrameGraph&) {
+            shadow_map.activate();
+            draw_depth();
+            shadow_map.deactivate();
+        });
+
+        // The scene is rendered offscreen at a resolution picked from the GPU time of the previous frames
+        resolution.enabled = dynamic_resolution;
+        resolution.update();
+        const GLsizei width = resolution.scaled(WIDTH);
+        const GLsizei height = resolution.scaled(HEIGHT);
+
+        // Deferred shading reads single pixels of the G-buffer, so its scene targets aren't multisampled
+        const bool deferred = main_shader == ShaderType::DEFERRED;
+        const GLsizei samples = deferred ? 0 : SCENE_SAMPLES;
+
+        if (deferred) {
+            frame_graph.add_pass("gbuffer", [this, width, height](FrameGraph::Builder& builder) {
+                gbuffer_albedo = builder.create("gbuffer_albedo", TextureDesc(width, height, GL_RGBA8));
+                gbuffer_normal = builder.create("gbuffer_normal", TextureDesc(width, height, GL_RGBA16F));
+                gbuffer_depth = builder.create("gbuffer_depth", TextureDesc(width, height, GL_DEPTH_COMPONENT24));
+                builder.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, glm::vec4(0.0f));
+            }, [this](const FrameGraph&) {
+                resolution.begin();
+                draw_gbuffer();
+            });
+        }
+
+        frame_graph.add_pass("skybox", [this, width, height, samples](FrameGraph::Builder& builder) {
+            scene_color = builder.create("scene_color", TextureDesc(width, height, GL_RGBA8, samples));
+            scene_depth = builder.create("scene_depth", TextureDesc(width, height, GL_DEPTH_COMPONENT24, samples));
+            builder.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }, [this, deferred](const FrameGraph&) {
+            if (!deferred) {
+                resolution.begin();
+            }
+            draw_skybox();
+        });
+
+        if (deferred) {
+            frame_graph.add_pass("lighting", [this](FrameGraph::Builder& builder) {
+                builder.read(gbuffer_albedo);
+                builder.read(gbuffer_normal);
+                builder.read(gbuffer_depth);
+                builder.read(shadow_depth);
+                builder.write(scene_color);
+                builder.write(scene_depth);
+            }, [this](const FrameGraph& graph) {
+                // Later forward passes are depth tested against the opaque geometry
+                graph.blit(gbuffer_depth, GL_NEAREST);
+
+                shadow_map.bind(graph.get_texture(shadow_depth));
+                draw_deferred_lighting(graph);
+                shadow_map.unbind();
+            });
+        }
 
-                object.draw();
-                GL_CHECK_ERRORS;
+        frame_graph.add_pass("particles", [this](FrameGraph::Builder& builder) {
+            builder.write(scene_color);
+            builder.write(scene_depth);
+        }, [this](const FrameGraph&) {
+            draw_particles();
+        });
+
+        // Translucent draws are always shaded forward, blended over the lit opaque ones
+        frame_graph.add_pass("objects", [this](FrameGraph::Builder& builder) {
+            builder.read(shadow_depth);
+            builder.write(scene_color);
+            builder.write(scene_depth);
+        }, [this, deferred](const FrameGraph& graph) {
+            if (main_shader == ShaderType::OVERDRAW) {
+                if (depth_prepass) {
+                    draw_depth_prepass();
+                }
+                draw_overdraw();
+                return;
+            }
+
+            shadow_map.bind(graph.get_texture(shadow_depth));
+            if (deferred) {
+                draw_objects(DrawSubset::TRANSLUCENT);
+            } else if (depth_prepass) {
+                // Translucent draws aren't in the prepass, they go after the opaque ones with the usual test
+                draw_depth_prepass();
+                draw_objects(DrawSubset::OPAQUE);
+                draw_objects(DrawSubset::TRANSLUCENT);
+            } else {
+                draw_objects(DrawSubset::ALL);
             }
+            shadow_map.unbind();
+        });
+
+        frame_graph.add_pass("effects", [this](FrameGraph::Builder& builder) {
+            builder.write(scene_color);
+            builder.write(scene_depth);
+        }, [this](const FrameGraph&) {
+            draw_thruster();
+            draw_explosions();
+            draw_lines();
+            resolution.end();
+        });
+
+        // Multisampled textures can't be scaled by a blit, so resolve at the same size first.
+        // Single sampled scene targets are upscaled directly
+        if (samples > 0) {
+            frame_graph.add_pass("resolve", [this, width, height](FrameGraph::Builder& builder) {
+                builder.read(scene_color);
+                scene_resolved = builder.create("scene_resolved", TextureDesc(width, height, GL_RGBA8));
+            }, [this](const FrameGraph& graph) {
+                graph.blit(scene_color, GL_NEAREST);
+            });
+        } else {
+            scene_resolved = scene_color;
         }
-        program.StopUseShader();
+
+        frame_graph.add_pass("upscale", [this](FrameGraph::Builder& builder) {
+            builder.read(scene_resolved);
+            builder.write(backbuffer);
+        }, [this](const FrameGraph& graph) {
+            graph.blit(scene_resolved, GL_LINEAR);
+        });
+
+        if (main_shader == ShaderType::DEPTH) {
+            // Show depth only in part of the screen
+            frame_graph.add_pass("depth_view", [this](FrameGraph::Builder& builder) {
+                builder.write(backbuffer);
+                builder.viewport(0, 0, WIDTH / 3, HEIGHT / 3);
+                builder.clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, glm::vec4(1.0f));
+            }, [this](const FrameGraph&) {
+                draw_depth();
+            });
+        }
+
+        frame_graph.compile();
+        frame_graph.execute();
     }
 
     int game_loop() {
-        auto& main_ship = enemies.front();
-
         camera.move({4, 4, 0});
+        place_camera();
+        entities.update_transforms();
 
-        auto& asteroid = enemies.back();
-        float asteroid_state = 0.f;
-        constexpr float asteroid_step = 2 * M_PI / 60 / 10;  // Round every 10 seconds
-        const glm::vec3 asteroid_center = enemies.back().world_pos;
-
-        // Shadows
+        asteroid_center = entities.positions[entities.index(asteroid)];
 
-        ShadowMap shadow_map(
-            glm::ortho<float>(-30, 30, -20, 20, 10, 80)
-          * glm::lookAt(glm::vec3(12, 12, -12), glm::vec3(0, 0, -40), glm::vec3(0, 1, 0))
+        const glm::mat4 bias(
+            0.5, 0.0, 0.0, 0.0,
+            0.0, 0.5, 0.0, 0.0,
+            0.0, 0.0, 0.5, 0.0,
+            0.5, 0.5, 0.5, 1.0
         );
-        shadow_map.init(WIDTH, HEIGHT);
+        depth_matrix = bias * shadow_map.matrix;
+
+        store_state();
+        publish_input();
+        publish_state(glfwGetTime());
+
+        running = true;
+        simulation = std::thread(&Game::simulation_loop, this);
+
+        bool swap_interval = vsync;
+        double previous_time = glfwGetTime();
 
         while (!glfwWindowShouldClose(window)) {
+            next_allocation_frame();
+            const auto allocations_before = thread_allocation_count();
+            frame_arena.begin_frame();
+
             // Tech stuff
             glfwPollEvents();
+            workers.run_main_jobs();
 
-            glViewport(0, 0, WIDTH, HEIGHT);
-            glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            GL_CHECK_ERRORS;
+            if (swap_interval != vsync) {
+                swap_interval = vsync;
+                glfwSwapInterval(vsync ? 1 : 0);
+            }
 
-            // Game logic
+            publish_input();
 
-            modify_env();
+            // Effects are not part of the game state and advance with the frame
+            const double time = glfwGetTime();
+            const auto frame_time = float(std::min(time - previous_time, MAX_STEPS_PER_FRAME * SIMULATION_STEP));
+            previous_time = time;
 
-            particles_state += speed_multiplier * enemies_speed;
-            speed_multiplier += 0.0001f;
+            frame = &snapshots.read();
 
-            asteroid.world_pos = asteroid_center + 10.f * glm::vec3(sinf(asteroid_state), 0.f, cosf(asteroid_state));
-            asteroid_state += asteroid_step;
+            WorkerPool::Counter particles_updated;
+            {
+                AllocationScope scope("effects");
+                spawn_bursts();
+                // The particles advance on a worker while this thread goes on with the GL work of the frame
+                workers.submit([this, frame_time](int) { explosions.update(frame_time); }, &particles_updated);
+                update_thruster(frame_time);
+                update_lights(frame_time);
+            }
 
             // Drawing
 
-            shadow_map.activate();
-            draw_depth(shadow_map.matrix);
-            shadow_map.deactivate();
-
-            const glm::mat4 bias(
-                0.5, 0.0, 0.0, 0.0,
-                0.0, 0.5, 0.0, 0.0,
-                0.0, 0.0, 0.5, 0.0,
-                0.5, 0.5, 0.5, 1.0
-            );
-            const glm::mat4 depth_matrix = bias * shadow_map.matrix;
+            // The latest step lies in the past, draw between it and the one before
+            frame_alpha = glm::clamp(float((time - frame->time) / SIMULATION_STEP), 0.0f, 1.0f);
+            update_view(frame_alpha);
 
-            draw_skybox();
-            draw_particles();
-
-            shadow_map.bind();
-            draw_objects(depth_matrix);
-
-            if (main_shader == ShaderType::DEPTH) {
-                // Show depth only in part of the screen
-                glViewport(0, 0, WIDTH / 3, HEIGHT / 3);
+            {
+                AllocationScope scope("commands");
+                if (clustered_lighting) {
+                    light_clusters.build(lights, view_transform, perspective);
+                }
+                record_commands();
+            }
+            {
+                AllocationScope scope("render");
+                workers.wait(particles_updated);
+                render_frame();
+            }
 
-                glScissor(0, 0, WIDTH / 3, HEIGHT / 3);
-                glEnable(GL_SCISSOR_TEST);
-                glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                glDisable(GL_SCISSOR_TEST);
+            // Before the stats, printing them allocates
+            frame_allocations = thread_allocation_count() - allocations_before;
 
-                draw_depth(shadow_map.matrix);
+            if (print_stats) {
+                show_stats();
+                report_allocations(std::cout);
+                print_stats = false;
             }
 
             glfwSwapBuffers(window);
         }
+
+        running = false;
+        simulation.join();
+
+        // Whatever the game still holds at its end, for leak hunting in tracking builds
+        if (export_live_allocations("live_allocations.csv")) {
+            std::cout << "Live allocations written to live_allocations.csv" << std::endl;
+        }
+
         std::cout << "\nGame Over!" << std::endl;
 
         glfwTerminate();
@@ -537,6 +1570,10 @@ public:
 };
 
 int main(int argc, char **argv) {
+    if (argc > 2 && std::string(argv[1]) == "--benchmark") {
+        return run_benchmark(argv[2], argc > 3 ? std::stoul(argv[3]) : 100000);
+    }
+
     Game game;
     int init_code = game.init();
     if (init_code != 0) {